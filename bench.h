@@ -0,0 +1,30 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <time.h>
+
+/* Monotonic time, in nanoseconds */
+static inline double bench_now_ns(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* xorshift32: fast and reproducible, never returns 0 for a nonzero state */
+static inline unsigned int bench_rand(unsigned int *state) {
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+
+	return *state = x;
+}
+
+#endif /* BENCH_H */
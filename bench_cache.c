@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * Cache replacement policies replaying the same accesses: every document
+ * is looked up with lru_cache_get() and put in the cache on a miss. Prints
+ * the hit ratio and ns per access of each policy.
+ *
+ * Usage: ./bench_cache [input_file [cache_size]]
+ *      Replays the GETs and EDITs of an input file, or by default a
+ *      zipfian trace with periodic scans of documents read only once.
+ */
+
+#include <math.h>
+
+#include "bench.h"
+#include "input.h"
+#include "lru_cache.h"
+#include "utils.h"
+
+#define DEFAULT_CACHE_SIZE      1000
+#define ZIPF_DOCS               100000
+#define ZIPF_SKEW               0.99
+#define ZIPF_ACCESSES           2000000
+#define SCAN_EVERY              50000
+#define SCAN_LENGTH             5000
+
+typedef struct cache_access {
+	const char *name;
+	unsigned int hash;
+} cache_access;
+
+static const char *policies[] = {
+	LRU_POLICY, CLOCK_POLICY, S3FIFO_POLICY, ARC_POLICY, TINYLFU_POLICY
+};
+
+/* Document names of the GETs and EDITs of an input file, in order */
+static cache_access *read_input_accesses(input_file *in,
+										 unsigned int *count) {
+	char buffer[REQUEST_TYPE_LENGTH + 1];
+	unsigned int capacity = 1024, len;
+	cache_access *accesses = malloc(capacity * sizeof(cache_access));
+	DIE(accesses == NULL, "malloc failed");
+
+	*count = 0;
+	input_skip_line(in);
+
+	while (input_peek(in, buffer, sizeof(buffer))) {
+		request_type type;
+
+		if (strncmp(buffer, GET_REQUEST, strlen(GET_REQUEST)) &&
+			strncmp(buffer, EDIT_REQUEST, strlen(EDIT_REQUEST))) {
+			input_skip_line(in);
+			continue;
+		}
+
+		type = get_request_type(buffer);
+		if (*count == capacity) {
+			capacity *= 2;
+			accesses = realloc(accesses, capacity * sizeof(cache_access));
+			DIE(accesses == NULL, "realloc failed");
+		}
+
+		accesses[*count].name = input_quoted(in, &len);
+		accesses[*count].hash = hash_string((void *)accesses[*count].name);
+		(*count)++;
+
+		if (type == EDIT_DOCUMENT) {
+			input_quoted(in, &len);
+		}
+		input_skip_line(in);
+	}
+
+	return accesses;
+}
+
+/* Zipfian accesses, with a scan of never repeated documents now and then */
+static cache_access *zipf_accesses(unsigned int *count) {
+	double *cdf = malloc(ZIPF_DOCS * sizeof(double));
+	cache_access *accesses = malloc(ZIPF_ACCESSES * sizeof(cache_access));
+	unsigned int seed = 2024, scanned = 0;
+	double sum = 0;
+	DIE(!cdf || !accesses, "malloc failed");
+
+	for (unsigned int i = 0; i < ZIPF_DOCS; i++) {
+		sum += 1 / pow(i + 1, ZIPF_SKEW);
+		cdf[i] = sum;
+	}
+
+	for (unsigned int i = 0; i < ZIPF_ACCESSES; i++) {
+		char name[32];
+
+		if (i % SCAN_EVERY < SCAN_LENGTH && i >= SCAN_EVERY) {
+			sprintf(name, "scan_%u.txt", scanned++);
+		} else {
+			double target = sum * (bench_rand(&seed) / 4294967296.0);
+			unsigned int lo = 0, hi = ZIPF_DOCS - 1;
+
+			while (lo < hi) {
+				unsigned int mid = (lo + hi) / 2;
+
+				if (cdf[mid] < target) {
+					lo = mid + 1;
+				} else {
+					hi = mid;
+				}
+			}
+			sprintf(name, "doc_%u.txt", lo);
+		}
+
+		accesses[i].name = strdup(name);
+		DIE(accesses[i].name == NULL, "strdup failed");
+		accesses[i].hash = hash_string(name);
+	}
+
+	free(cdf);
+	*count = ZIPF_ACCESSES;
+
+	return accesses;
+}
+
+static void bench_policy(const char *policy, unsigned int cache_size,
+						 cache_access *accesses, unsigned int count) {
+	slab_allocator *slab = init_slab_allocator();
+	lru_cache *cache = init_lru_cache(cache_size, 0, slab,
+									  get_cache_policy_type(policy));
+	doc_value *doc = doc_value_create(slab, "value", 5);
+	char evicted_key[DOC_NAME_LENGTH + 1];
+	unsigned int hits = 0;
+
+	double start = bench_now_ns();
+	for (unsigned int i = 0; i < count; i++) {
+		void *name = (void *)accesses[i].name;
+
+		if (lru_cache_get(cache, accesses[i].hash, name)) {
+			hits++;
+		} else {
+			lru_cache_put(cache, accesses[i].hash, name, doc, evicted_key);
+		}
+	}
+	double ns = (bench_now_ns() - start) / count;
+
+	printf("%-8s hit ratio %6.2f%%  %6.1f ns/access\n", policy,
+		   100.0 * hits / count, ns);
+
+	free_lru_cache(&cache);
+	doc_value_release(slab, doc);
+	free_slab_allocator(&slab);
+}
+
+int main(int argc, char **argv) {
+	unsigned int cache_size = DEFAULT_CACHE_SIZE, count;
+	input_file *in = NULL;
+	cache_access *accesses;
+
+	if (argc > 1) {
+		in = open_input_file(argv[1]);
+		accesses = read_input_accesses(in, &count);
+	} else {
+		accesses = zipf_accesses(&count);
+	}
+
+	if (argc > 2) {
+		cache_size = atoi(argv[2]);
+		DIE(cache_size == 0, "cache size must be positive");
+	}
+
+	printf("%u accesses, %u cache entries\n", count, cache_size);
+	for (unsigned int i = 0; i < sizeof(policies) / sizeof(policies[0]); i++) {
+		bench_policy(policies[i], cache_size, accesses, count);
+	}
+
+	if (in) {
+		close_input_file(&in);
+	} else {
+		for (unsigned int i = 0; i < count; i++) {
+			free((void *)accesses[i].name);
+		}
+	}
+	free(accesses);
+
+	return 0;
+}
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * EDIT coalescing on one server: the same EDITs, coming in runs of 1 to N
+ * EDITs of one document, are executed from a full queue (coalesced) and one
+ * by one (each EDIT executed as soon as it is queued, so no run forms).
+ * Prints the ns per EDIT and how many values are written to the database
+ * (db_put/entry_set_value) and to the cache (lru_cache_put/
+ * lru_cache_set_value). The calls are counted by linking with
+ * -Wl,--wrap=<function>, which the Makefile does for this bench only.
+ */
+
+#include "bench.h"
+#include "database.h"
+#include "server.h"
+
+#define DOCS            10000
+#define EDITS           1000000
+#define CONTENT_LENGTH  256
+#define CACHE_SIZE      1000
+
+typedef struct call_counts {
+	unsigned long db_put;
+	unsigned long entry_set_value;
+	unsigned long lru_cache_put;
+	unsigned long lru_cache_set_value;
+} call_counts;
+
+static call_counts calls;
+
+entry *__real_db_put(db *db, unsigned int hash, void *key, void *value,
+					 unsigned int value_len);
+void __real_entry_set_value(slab_allocator *slab, entry *entry, void *value,
+							unsigned int value_len);
+bool __real_lru_cache_put(lru_cache *cache, unsigned int hash, void *key,
+						  doc_value *doc, char *evicted_key);
+void __real_lru_cache_set_value(lru_cache *cache, entry *entry,
+								doc_value *doc);
+
+entry *__wrap_db_put(db *db, unsigned int hash, void *key, void *value,
+					 unsigned int value_len) {
+	calls.db_put++;
+	return __real_db_put(db, hash, key, value, value_len);
+}
+
+void __wrap_entry_set_value(slab_allocator *slab, entry *entry, void *value,
+							unsigned int value_len) {
+	calls.entry_set_value++;
+	__real_entry_set_value(slab, entry, value, value_len);
+}
+
+bool __wrap_lru_cache_put(lru_cache *cache, unsigned int hash, void *key,
+						  doc_value *doc, char *evicted_key) {
+	calls.lru_cache_put++;
+	return __real_lru_cache_put(cache, hash, key, doc, evicted_key);
+}
+
+void __wrap_lru_cache_set_value(lru_cache *cache, entry *entry,
+								doc_value *doc) {
+	calls.lru_cache_set_value++;
+	__real_lru_cache_set_value(cache, entry, doc);
+}
+
+static char names[DOCS][DOC_NAME_LENGTH + 1];
+static unsigned int hashes[DOCS];
+
+/* Runs of 1 to max_run EDITs of a random document, each with new content */
+static void make_edits(unsigned int max_run, unsigned int *docs,
+					   unsigned int *versions) {
+	unsigned int seed = 2024;
+
+	for (unsigned int i = 0; i < EDITS;) {
+		unsigned int doc = bench_rand(&seed) % DOCS;
+		unsigned int run = 1 + bench_rand(&seed) % max_run;
+
+		for (unsigned int j = 0; j < run && i < EDITS; j++, i++) {
+			docs[i] = doc;
+			versions[i] = bench_rand(&seed);
+		}
+	}
+}
+
+static void bench_edits(bool coalesce, unsigned int *docs,
+						unsigned int *versions) {
+	server *s = init_server(1, CACHE_SIZE, 0, CACHE_POLICY_LRU, DB_CHAINED);
+	output_buffer out = { 0 };
+	char content[CONTENT_LENGTH + 1];
+
+	s->out = &out;
+	memset(content, 'x', CONTENT_LENGTH);
+	content[CONTENT_LENGTH] = '\0';
+	memset(&calls, 0, sizeof(calls));
+
+	double start = bench_now_ns();
+	for (unsigned int i = 0; i < EDITS; i++) {
+		request req = {
+			.type = EDIT_DOCUMENT,
+			.doc_name = names[docs[i]],
+			.doc_hash = hashes[docs[i]],
+			.doc_content = content,
+			.doc_content_len = CONTENT_LENGTH,
+		};
+
+		sprintf(content, "%08x", versions[i]);
+		content[8] = 'x';
+
+		server_print_response(s, server_enqueue_request(s, &req, true));
+		if (!coalesce) {
+			server_execute_all_requests(s);
+		}
+
+		// Only the work matters, not the responses
+		out.len = 0;
+	}
+	server_execute_all_requests(s);
+	double ns = (bench_now_ns() - start) / EDITS;
+
+	printf("  %-10s %6.1f ns/EDIT  db_put %7lu  entry_set_value %7lu  "
+		   "lru_cache_put %7lu  lru_cache_set_value %7lu\n",
+		   coalesce ? "coalesced" : "one by one", ns, calls.db_put,
+		   calls.entry_set_value, calls.lru_cache_put,
+		   calls.lru_cache_set_value);
+
+	free(out.data);
+	free_server(&s);
+}
+
+int main(void) {
+	unsigned int *docs = malloc(EDITS * sizeof(unsigned int));
+	unsigned int *versions = malloc(EDITS * sizeof(unsigned int));
+	DIE(!docs || !versions, "malloc failed");
+
+	for (unsigned int i = 0; i < DOCS; i++) {
+		sprintf(names[i], "doc_%u.txt", i);
+		hashes[i] = hash_string(names[i]);
+	}
+
+	printf("%u EDITs of %u documents, %u cache entries\n", EDITS, DOCS,
+		   CACHE_SIZE);
+	for (unsigned int max_run = 1; max_run <= 16; max_run *= 2) {
+		make_edits(max_run, docs, versions);
+
+		printf("runs of 1 to %u EDITs:\n", max_run);
+		bench_edits(true, docs, versions);
+		bench_edits(false, docs, versions);
+	}
+
+	free(docs);
+	free(versions);
+
+	return 0;
+}
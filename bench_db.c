@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * Server database engines: ns per db_put() while filling a database with
+ * 10k to 10M documents, then per db_get() of random stored documents and of
+ * missing ones, for DB_CHAINED and DB_SWISS.
+ */
+
+#include "bench.h"
+#include "database.h"
+
+#define MAX_KEYS        10000000
+#define GETS            (1 << 20)
+#define NAME_SIZE       16
+
+static char (*names)[NAME_SIZE];
+static unsigned int *hashes;
+
+static void bench_db(db_engine engine, unsigned int keys,
+					 unsigned int *picks) {
+	slab_allocator *slab = init_slab_allocator();
+	db *db = init_db(slab, engine);
+	unsigned long found = 0;
+	char missing[NAME_SIZE];
+
+	double start = bench_now_ns();
+	for (unsigned int i = 0; i < keys; i++) {
+		db_put(db, hashes[i], names[i], "value", 5);
+	}
+	double put_ns = (bench_now_ns() - start) / keys;
+
+	start = bench_now_ns();
+	for (unsigned int i = 0; i < GETS; i++) {
+		unsigned int k = picks[i] % keys;
+
+		found += db_get(db, hashes[k], names[k]) != NULL;
+	}
+	double hit_ns = (bench_now_ns() - start) / GETS;
+
+	// A name which is not stored, with the hash of one which is, so the
+	// probe goes all the way to the key comparison
+	start = bench_now_ns();
+	for (unsigned int i = 0; i < GETS; i++) {
+		unsigned int k = picks[i] % keys;
+
+		memcpy(missing, names[k], NAME_SIZE);
+		missing[0] = 'X';
+		found += db_get(db, hashes[k], missing) != NULL;
+	}
+	double miss_ns = (bench_now_ns() - start) / GETS;
+
+	printf("%-7s %8u keys: put %6.1f ns  get hit %6.1f ns  "
+		   "get miss %6.1f ns  (found %lu)\n",
+		   engine == DB_SWISS ? "SWISS" : "CHAINED", keys, put_ns, hit_ns,
+		   miss_ns, found);
+
+	free_db(&db);
+	free_slab_allocator(&slab);
+}
+
+int main(void) {
+	unsigned int *picks = malloc(GETS * sizeof(unsigned int));
+	unsigned int seed = 2024;
+
+	names = malloc((size_t)MAX_KEYS * NAME_SIZE);
+	hashes = malloc((size_t)MAX_KEYS * sizeof(unsigned int));
+	DIE(!picks || !names || !hashes, "malloc failed");
+
+	for (unsigned int i = 0; i < MAX_KEYS; i++) {
+		snprintf(names[i], NAME_SIZE, "doc_%u.txt", i);
+		hashes[i] = hash_string(names[i]);
+	}
+	for (unsigned int i = 0; i < GETS; i++) {
+		picks[i] = bench_rand(&seed);
+	}
+
+	for (unsigned int keys = 10000; keys <= MAX_KEYS; keys *= 10) {
+		bench_db(DB_CHAINED, keys, picks);
+		bench_db(DB_SWISS, keys, picks);
+	}
+
+	free(names);
+	free(hashes);
+	free(picks);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * Placement engines side by side, with 100 servers: lookup cost, share of
+ * the keys which change servers when one server is added or removed
+ * (ideally 1/101 and 1/100), and how evenly the keys are spread.
+ */
+
+#include <math.h>
+
+#include "bench.h"
+#include "placement.h"
+
+#define SERVERS         100
+#define KEYS            (1 << 20)
+#define ROUNDS          4
+
+typedef struct engine {
+	const char *name;
+	placement_type type;
+	unsigned int vnodes;
+} engine;
+
+static const engine engines[] = {
+	{"RING (3 vnodes)", PLACEMENT_RING, 3},
+	{"RING (128 vnodes)", PLACEMENT_RING, 128},
+	{MAGLEV_PLACEMENT, PLACEMENT_MAGLEV, 1},
+	{RENDEZVOUS_PLACEMENT, PLACEMENT_RENDEZVOUS, 1},
+	{JUMP_PLACEMENT, PLACEMENT_JUMP, 1},
+};
+
+static void owners_of(placement *p, unsigned int *hashes, server **owners) {
+	for (unsigned int i = 0; i < KEYS; i++) {
+		owners[i] = placement_lookup(p, hashes[i]);
+	}
+}
+
+static double moved_share(server **before, server **after) {
+	unsigned int moved = 0;
+
+	for (unsigned int i = 0; i < KEYS; i++) {
+		moved += before[i] != after[i];
+	}
+
+	return 100.0 * moved / KEYS;
+}
+
+static void bench_engine(const engine *e, unsigned int *hashes) {
+	placement *p = init_placement(e->type, e->vnodes, hash_uint);
+	server *servers[SERVERS + 1];
+	server *sources[SERVERS + 1];
+	server **before = malloc(KEYS * sizeof(server *));
+	server **after = malloc(KEYS * sizeof(server *));
+	DIE(!before || !after, "malloc failed");
+
+	for (unsigned int i = 0; i <= SERVERS; i++) {
+		servers[i] = init_server(i * 7919 + 1, 1, 0, CACHE_POLICY_LRU,
+								 DB_CHAINED);
+	}
+	for (unsigned int i = 0; i < SERVERS; i++) {
+		placement_add_server(p, servers[i], sources);
+	}
+
+	// Lookup cost
+	unsigned long checksum = 0;
+	double start = bench_now_ns();
+
+	for (unsigned int round = 0; round < ROUNDS; round++) {
+		for (unsigned int i = 0; i < KEYS; i++) {
+			checksum += placement_lookup(p, hashes[i])->server_id;
+		}
+	}
+	double ns = (bench_now_ns() - start) / ((double)ROUNDS * KEYS);
+
+	// Spread of the keys: the fullest server and the standard deviation,
+	// relative to the mean
+	unsigned int counts[SERVERS] = {0};
+	unsigned int max = 0;
+	double mean = (double)KEYS / SERVERS, variance = 0;
+
+	owners_of(p, hashes, before);
+	for (unsigned int i = 0; i < KEYS; i++) {
+		for (unsigned int j = 0; j < SERVERS; j++) {
+			if (before[i] == servers[j]) {
+				counts[j]++;
+				break;
+			}
+		}
+	}
+	for (unsigned int j = 0; j < SERVERS; j++) {
+		max = counts[j] > max ? counts[j] : max;
+		variance += (counts[j] - mean) * (counts[j] - mean) / SERVERS;
+	}
+
+	// Keys moved by adding a server, then by removing another one
+	placement_add_server(p, servers[SERVERS], sources);
+	owners_of(p, hashes, after);
+	double added = moved_share(before, after);
+
+	placement_remove_server(p, servers[SERVERS / 2], sources);
+	owners_of(p, hashes, before);
+	double removed = moved_share(after, before);
+
+	printf("%-18s %7.2f ns/lookup  max/mean %.2f  stddev %5.1f%%  "
+		   "moved on add %5.2f%%  on remove %5.2f%%  (checksum %lu)\n",
+		   e->name, ns, max / mean, 100 * sqrt(variance) / mean, added,
+		   removed, checksum);
+
+	for (unsigned int i = 0; i <= SERVERS; i++) {
+		free_server(&servers[i]);
+	}
+	free(before);
+	free(after);
+	free_placement(&p);
+}
+
+int main(void) {
+	unsigned int *hashes = malloc(KEYS * sizeof(unsigned int));
+	unsigned int seed = 2024;
+	DIE(hashes == NULL, "malloc failed");
+
+	// Document names hashed the way the load balancer hashes them
+	for (unsigned int i = 0; i < KEYS; i++) {
+		char name[32];
+
+		sprintf(name, "doc_%u.txt", bench_rand(&seed));
+		hashes[i] = hash_string(name);
+	}
+
+	for (unsigned int i = 0; i < sizeof(engines) / sizeof(engines[0]); i++) {
+		bench_engine(&engines[i], hashes);
+	}
+
+	free(hashes);
+
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * Ring lookup cost: ns per placement_lookup() on rings of 10, 1k and 100k
+ * points, for random document hashes.
+ */
+
+#include "bench.h"
+#include "placement.h"
+
+#define LOOKUPS         (1 << 20)
+#define ROUNDS          8
+
+static void bench_ring(unsigned int servers_count, unsigned int vnodes,
+					   unsigned int *hashes) {
+	placement *p = init_placement(PLACEMENT_RING, vnodes, hash_uint);
+	server **servers = calloc(servers_count, sizeof(server *));
+	server **sources = calloc(servers_count, sizeof(server *));
+	DIE(!servers || !sources, "calloc failed");
+
+	for (unsigned int i = 0; i < servers_count; i++) {
+		servers[i] = init_server(i + 1, 1, 0, CACHE_POLICY_LRU, DB_CHAINED);
+		placement_add_server(p, servers[i], sources);
+	}
+
+	unsigned long checksum = 0;
+	double start = bench_now_ns();
+
+	for (unsigned int round = 0; round < ROUNDS; round++) {
+		for (unsigned int i = 0; i < LOOKUPS; i++) {
+			checksum += placement_lookup(p, hashes[i])->server_id;
+		}
+	}
+
+	double ns = (bench_now_ns() - start) / ((double)ROUNDS * LOOKUPS);
+
+	printf("%7u points: %6.2f ns/lookup (checksum %lu)\n",
+		   servers_count * vnodes, ns, checksum);
+
+	for (unsigned int i = 0; i < servers_count; i++) {
+		free_server(&servers[i]);
+	}
+	free(servers);
+	free(sources);
+	free_placement(&p);
+}
+
+int main(void) {
+	unsigned int *hashes = malloc(LOOKUPS * sizeof(unsigned int));
+	unsigned int seed = 2024;
+	DIE(hashes == NULL, "malloc failed");
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		hashes[i] = bench_rand(&seed);
+	}
+
+	bench_ring(10, 1, hashes);
+	bench_ring(10, 100, hashes);
+	bench_ring(100, 1000, hashes);
+
+	free(hashes);
+
+	return 0;
+}
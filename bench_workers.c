@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+/*
+ * Throughput of the load balancer with 1 to 16 servers, on a single thread
+ * and with WORKER_THREADS, for uniformly spread GETs and EDITs. The
+ * responses are discarded.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "bench.h"
+#include "load_balancer.h"
+
+#define DOCS            100000
+#define REQUESTS        1000000
+#define CONTENT_LENGTH  256
+#define CACHE_SIZE      1000
+#define VNODES          64
+
+static char names[DOCS][DOC_NAME_LENGTH + 1];
+static unsigned int hashes[DOCS];
+
+static double bench_run(unsigned int servers_count, bool workers,
+						unsigned int *picks, char *content) {
+	load_balancer *main = init_load_balancer(true, VNODES, PLACEMENT_RING);
+
+	if (workers) {
+		loader_enable_workers(main);
+	}
+
+	for (unsigned int i = 0; i < servers_count; i++) {
+		loader_add_server(main, i * 7919 + 1, CACHE_SIZE, 0, 1,
+						  CACHE_POLICY_LRU);
+	}
+
+	double start = bench_now_ns();
+
+	for (unsigned int i = 0; i < REQUESTS; i++) {
+		unsigned int doc = picks[i] % DOCS;
+		request req = {
+			.type = picks[i] & (1U << 31) ? EDIT_DOCUMENT : GET_DOCUMENT,
+			.doc_name = names[doc],
+			.doc_hash = hashes[doc],
+		};
+
+		if (req.type == EDIT_DOCUMENT) {
+			req.doc_content = content;
+			req.doc_content_len = CONTENT_LENGTH;
+		}
+
+		loader_print_response(main, loader_forward_request(main, &req));
+	}
+
+	// Freeing waits for the workers and prints what is left
+	free_load_balancer(&main);
+
+	return REQUESTS / ((bench_now_ns() - start) / 1e9);
+}
+
+int main(void) {
+	static unsigned int picks[REQUESTS];
+	static char content[CONTENT_LENGTH + 1];
+	unsigned int seed = 2024;
+	int out = dup(STDOUT_FILENO);
+	FILE *report = fdopen(out, "w");
+	int null = open("/dev/null", O_WRONLY);
+
+	DIE(out < 0 || report == NULL || null < 0, "cannot redirect stdout");
+	DIE(dup2(null, STDOUT_FILENO) < 0, "dup2 failed");
+	close(null);
+
+	for (unsigned int i = 0; i < DOCS; i++) {
+		sprintf(names[i], "doc_%u.txt", i);
+		hashes[i] = hash_string(names[i]);
+	}
+	for (unsigned int i = 0; i < REQUESTS; i++) {
+		picks[i] = bench_rand(&seed);
+	}
+	memset(content, 'x', CONTENT_LENGTH);
+
+	fprintf(report, "%ld online CPUs, %u requests\n",
+			sysconf(_SC_NPROCESSORS_ONLN), REQUESTS);
+	for (unsigned int n = 1; n <= 16; n *= 2) {
+		double single = bench_run(n, false, picks, content);
+		double threaded = bench_run(n, true, picks, content);
+
+		fprintf(report, "%2u servers: single thread %7.0f req/s  "
+				"WORKER_THREADS %7.0f req/s  (x%.2f)\n",
+				n, single, threaded, threaded / single);
+	}
+
+	fclose(report);
+
+	return 0;
+}
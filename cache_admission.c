@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include "cache_admission.h"
+#include "utils.h"
+
+#define BITS_PER_WORD           (8 * sizeof(unsigned long))
+
+void sketch_init(frequency_sketch *f, unsigned int capacity)
+{
+	unsigned int width = 16;
+
+	while (width < capacity) {
+		width *= 2;
+	}
+
+	for (int i = 0; i < SKETCH_ROWS; i++) {
+		f->counters[i] = calloc(width, sizeof(unsigned char));
+		DIE(f->counters[i] == NULL, "calloc failed");
+	}
+
+	f->width_mask = width - 1;
+	f->additions = 0;
+	f->sample = 10 * width;
+}
+
+void sketch_free(frequency_sketch *f)
+{
+	for (int i = 0; i < SKETCH_ROWS; i++) {
+		free(f->counters[i]);
+	}
+}
+
+unsigned int sketch_estimate(frequency_sketch *f, unsigned int hash)
+{
+	unsigned int estimate = SKETCH_MAX_COUNT;
+
+	for (int i = 0; i < SKETCH_ROWS; i++) {
+		unsigned int count =
+				f->counters[i][hash_mix(hash, i + 1) & f->width_mask];
+
+		if (count < estimate) {
+			estimate = count;
+		}
+	}
+
+	return estimate;
+}
+
+bool sketch_increment(frequency_sketch *f, unsigned int hash)
+{
+	for (int i = 0; i < SKETCH_ROWS; i++) {
+		unsigned char *count =
+				&f->counters[i][hash_mix(hash, i + 1) & f->width_mask];
+
+		if (*count < SKETCH_MAX_COUNT) {
+			(*count)++;
+		}
+	}
+
+	if (++f->additions == f->sample) {
+		for (int i = 0; i < SKETCH_ROWS; i++) {
+			for (unsigned int j = 0; j <= f->width_mask; j++) {
+				f->counters[i][j] >>= 1;
+			}
+		}
+		f->additions /= 2;
+		return true;
+	}
+
+	return false;
+}
+
+cache_admission *init_cache_admission(unsigned int capacity)
+{
+	cache_admission *admission = calloc(1, sizeof(cache_admission));
+	DIE(admission == NULL, "calloc failed");
+
+	sketch_init(&admission->sketch, capacity);
+
+	// Sized for `sample` keys; more first accesses between two clears only
+	// raise its false positive rate
+	unsigned int bits = BITS_PER_WORD;
+	while (bits < admission->sketch.sample * DOORKEEPER_BITS_PER_KEY) {
+		bits *= 2;
+	}
+
+	admission->doorkeeper = calloc(bits / BITS_PER_WORD,
+								   sizeof(unsigned long));
+	DIE(admission->doorkeeper == NULL, "calloc failed");
+
+	admission->doorkeeper_mask = bits - 1;
+
+	return admission;
+}
+
+void free_cache_admission(cache_admission **admission)
+{
+	sketch_free(&(*admission)->sketch);
+	free((*admission)->doorkeeper);
+	free(*admission);
+	*admission = NULL;
+}
+
+static bool doorkeeper_contains(cache_admission *admission, unsigned int hash)
+{
+	for (int i = 0; i < DOORKEEPER_HASHES; i++) {
+		unsigned int bit = hash_mix(hash, SKETCH_ROWS + i + 1) &
+						   admission->doorkeeper_mask;
+
+		if (!(admission->doorkeeper[bit / BITS_PER_WORD] &
+			  (1UL << (bit % BITS_PER_WORD)))) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void doorkeeper_add(cache_admission *admission, unsigned int hash)
+{
+	for (int i = 0; i < DOORKEEPER_HASHES; i++) {
+		unsigned int bit = hash_mix(hash, SKETCH_ROWS + i + 1) &
+						   admission->doorkeeper_mask;
+
+		admission->doorkeeper[bit / BITS_PER_WORD] |=
+				1UL << (bit % BITS_PER_WORD);
+	}
+}
+
+void admission_record(cache_admission *admission, unsigned int hash)
+{
+	if (!doorkeeper_contains(admission, hash)) {
+		doorkeeper_add(admission, hash);
+	} else if (sketch_increment(&admission->sketch, hash)) {
+		// Age both together: the keys seen only once are forgotten
+		memset(admission->doorkeeper, 0, (admission->doorkeeper_mask + 1) /
+										 BITS_PER_WORD * sizeof(unsigned long));
+	}
+}
+
+bool admission_allows(cache_admission *admission, unsigned int hash)
+{
+	unsigned int frequency = sketch_estimate(&admission->sketch, hash);
+
+	if (doorkeeper_contains(admission, hash)) {
+		frequency++;
+	}
+
+	return frequency >= ADMISSION_MIN_FREQ;
+}
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef CACHE_ADMISSION_H
+#define CACHE_ADMISSION_H
+
+#include <stdbool.h>
+
+#define SKETCH_ROWS             4
+#define SKETCH_MAX_COUNT        15
+#define DOORKEEPER_BITS_PER_KEY 8
+#define DOORKEEPER_HASHES       3
+
+/* Accesses a key needs to be admitted into a full cache */
+#define ADMISSION_MIN_FREQ      2
+
+/*
+ * Count-min sketch of access frequencies, with saturating counters which
+ * are all halved once `sample` increments were counted, so old popularity
+ * fades away. The count of increments is halved with them, so the next
+ * halving comes after sample / 2 more.
+ */
+typedef struct frequency_sketch {
+	unsigned char *counters[SKETCH_ROWS];
+	unsigned int width_mask;
+	unsigned int additions;
+	unsigned int sample;
+} frequency_sketch;
+
+/*
+ * TinyLFU admission gate. The first access of a key only sets its bits in
+ * the doorkeeper Bloom filter; the following ones are counted by the
+ * sketch. The doorkeeper is cleared whenever the sketch halves its
+ * counters, so keys seen once a long time ago count as new again.
+ */
+typedef struct cache_admission {
+	frequency_sketch sketch;
+	unsigned long *doorkeeper;
+	unsigned int doorkeeper_mask;   /* Number of bits - 1 */
+} cache_admission;
+
+void sketch_init(frequency_sketch *f, unsigned int capacity);
+
+void sketch_free(frequency_sketch *f);
+
+unsigned int sketch_estimate(frequency_sketch *f, unsigned int hash);
+
+/**
+ * sketch_increment() - Counts one access to hash.
+ *
+ * @return - true if this increment made the sketch halve its counters.
+ */
+bool sketch_increment(frequency_sketch *f, unsigned int hash);
+
+/**
+ * init_cache_admission() - Creates an admission gate sized for a cache of
+ *      the given number of entries.
+ */
+cache_admission *init_cache_admission(unsigned int capacity);
+
+void free_cache_admission(cache_admission **admission);
+
+/**
+ * admission_record() - Counts an access to the key with the given hash.
+ */
+void admission_record(cache_admission *admission, unsigned int hash);
+
+/**
+ * admission_allows() - Checks whether the key was accessed at least
+ *      ADMISSION_MIN_FREQ times recently (the doorkeeper counting as one).
+ */
+bool admission_allows(cache_admission *admission, unsigned int hash);
+
+#endif /* CACHE_ADMISSION_H */
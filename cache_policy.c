@@ -0,0 +1,814 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include "lru_cache.h"
+#include "cache_admission.h"
+#include "utils.h"
+
+/* Queue an entry is linked in, stored in entry->queue */
+enum {
+	QUEUE_NONE,
+	QUEUE_MAIN,             /* LRU, CLOCK, S3-FIFO main */
+	QUEUE_SMALL,            /* S3-FIFO */
+	QUEUE_T1,               /* ARC: seen once recently */
+	QUEUE_T2,               /* ARC: seen at least twice */
+	QUEUE_WINDOW,           /* W-TinyLFU */
+	QUEUE_PROBATION,
+	QUEUE_PROTECTED
+};
+
+#define S3FIFO_MAX_FREQ         3
+
+/* Entries linked through next/prev, oldest at head */
+typedef struct cache_queue {
+	entry *head;
+	entry *tail;
+	unsigned int size;
+} cache_queue;
+
+static void queue_push(cache_queue *q, entry *e, unsigned char queue)
+{
+	e->queue = queue;
+	e->next = NULL;
+	e->prev = q->tail;
+
+	if (q->tail) {
+		q->tail->next = e;
+	} else {
+		q->head = e;
+	}
+
+	q->tail = e;
+	q->size++;
+}
+
+static void queue_unlink(cache_queue *q, entry *e)
+{
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		q->head = e->next;
+	}
+
+	if (e->next) {
+		e->next->prev = e->prev;
+	} else {
+		q->tail = e->prev;
+	}
+
+	e->next = NULL;
+	e->prev = NULL;
+	e->queue = QUEUE_NONE;
+	q->size--;
+}
+
+static entry *queue_pop(cache_queue *q)
+{
+	entry *e = q->head;
+
+	if (e) {
+		queue_unlink(q, e);
+	}
+
+	return e;
+}
+
+/* Appends the entries of a queue to entries, newest first */
+static unsigned int queue_rank(cache_queue *q, entry **entries)
+{
+	unsigned int count = 0;
+
+	for (entry *e = q->tail; e; e = e->prev) {
+		entries[count++] = e;
+	}
+
+	return count;
+}
+
+static void queue_move_to_tail(cache_queue *q, entry *e)
+{
+	if (q->tail != e) {
+		unsigned char queue = e->queue;
+
+		queue_unlink(q, e);
+		queue_push(q, e, queue);
+	}
+}
+
+/*
+ * Keys of recently evicted entries, remembered by hash only. The oldest
+ * hash is forgotten when a new one does not fit; fifo slots whose hash was
+ * removed in the meantime are dead and only wait for their turn. A linear
+ * probing index maps every live hash to its fifo slot.
+ */
+typedef struct ghost_list {
+	unsigned int *fifo;
+	unsigned char *live;
+	unsigned int capacity;
+	unsigned int head;
+	unsigned int used;              /* Fifo slots, dead ones included */
+	unsigned int size;              /* Live hashes */
+
+	unsigned int *index_hash;
+	unsigned int *index_slot;       /* Fifo slot + 1, 0 for a free bucket */
+	unsigned int index_mask;
+} ghost_list;
+
+static void ghost_init(ghost_list *g, unsigned int capacity)
+{
+	unsigned int buckets = 16;
+
+	while (buckets < 2 * capacity) {
+		buckets *= 2;
+	}
+
+	g->fifo = malloc(capacity * sizeof(unsigned int));
+	g->live = calloc(capacity, sizeof(unsigned char));
+	g->index_hash = malloc(buckets * sizeof(unsigned int));
+	g->index_slot = calloc(buckets, sizeof(unsigned int));
+	DIE(!g->fifo || !g->live || !g->index_hash || !g->index_slot,
+		"malloc failed");
+
+	g->capacity = capacity;
+	g->head = 0;
+	g->used = 0;
+	g->size = 0;
+	g->index_mask = buckets - 1;
+}
+
+static void ghost_free(ghost_list *g)
+{
+	free(g->fifo);
+	free(g->live);
+	free(g->index_hash);
+	free(g->index_slot);
+}
+
+/* Bucket holding hash in the index, or the free bucket where it would go */
+static unsigned int ghost_find(ghost_list *g, unsigned int hash)
+{
+	unsigned int bucket = hash_mix(hash, 0) & g->index_mask;
+
+	while (g->index_slot[bucket] && g->index_hash[bucket] != hash) {
+		bucket = (bucket + 1) & g->index_mask;
+	}
+
+	return bucket;
+}
+
+static void ghost_index_delete(ghost_list *g, unsigned int bucket)
+{
+	unsigned int next = (bucket + 1) & g->index_mask;
+
+	// Shift back the following entries which may not be left behind a hole
+	while (g->index_slot[next]) {
+		unsigned int home = hash_mix(g->index_hash[next], 0) & g->index_mask;
+
+		if (((next - home) & g->index_mask) >=
+			((next - bucket) & g->index_mask)) {
+			g->index_hash[bucket] = g->index_hash[next];
+			g->index_slot[bucket] = g->index_slot[next];
+			bucket = next;
+		}
+		next = (next + 1) & g->index_mask;
+	}
+
+	g->index_slot[bucket] = 0;
+}
+
+/* Forgets a hash, returning whether it was remembered */
+static bool ghost_remove(ghost_list *g, unsigned int hash)
+{
+	unsigned int bucket = ghost_find(g, hash);
+
+	if (!g->index_slot[bucket]) {
+		return false;
+	}
+
+	g->live[g->index_slot[bucket] - 1] = 0;
+	g->size--;
+	ghost_index_delete(g, bucket);
+
+	return true;
+}
+
+static bool ghost_contains(ghost_list *g, unsigned int hash)
+{
+	return g->index_slot[ghost_find(g, hash)] != 0;
+}
+
+/* Forgets the oldest live hash */
+static void ghost_pop(ghost_list *g)
+{
+	while (g->used > 0) {
+		unsigned int slot = g->head;
+
+		g->head = (g->head + 1) % g->capacity;
+		g->used--;
+
+		if (g->live[slot]) {
+			ghost_remove(g, g->fifo[slot]);
+			return;
+		}
+	}
+}
+
+static void ghost_push(ghost_list *g, unsigned int hash)
+{
+	ghost_remove(g, hash);
+
+	// Make room by dropping the oldest slot, dead or alive
+	if (g->used == g->capacity) {
+		unsigned int slot = g->head;
+
+		if (g->live[slot]) {
+			ghost_remove(g, g->fifo[slot]);
+		}
+		g->head = (g->head + 1) % g->capacity;
+		g->used--;
+	}
+
+	unsigned int slot = (g->head + g->used) % g->capacity;
+	unsigned int bucket = ghost_find(g, hash);
+
+	g->fifo[slot] = hash;
+	g->live[slot] = 1;
+	g->used++;
+	g->size++;
+
+	g->index_hash[bucket] = hash;
+	g->index_slot[bucket] = slot + 1;
+}
+
+/*
+ * LRU: a single queue in recency order. Hits move the entry to the tail
+ * and the head is evicted.
+ */
+static void lru_init(lru_cache *cache)
+{
+	cache->policy_state = calloc(1, sizeof(cache_queue));
+	DIE(cache->policy_state == NULL, "calloc failed");
+}
+
+static void lru_free(lru_cache *cache)
+{
+	free(cache->policy_state);
+}
+
+static entry *lru_evict(lru_cache *cache)
+{
+	return queue_pop(cache->policy_state);
+}
+
+static void lru_insert(lru_cache *cache, entry *e)
+{
+	queue_push(cache->policy_state, e, QUEUE_MAIN);
+}
+
+static void lru_hit(lru_cache *cache, entry *e)
+{
+	queue_move_to_tail(cache->policy_state, e);
+}
+
+static void lru_remove(lru_cache *cache, entry *e)
+{
+	queue_unlink(cache->policy_state, e);
+}
+
+static unsigned int lru_rank(lru_cache *cache, entry **entries)
+{
+	return queue_rank(cache->policy_state, entries);
+}
+
+/*
+ * CLOCK: entries sit on a circle in insertion order and a hit only sets
+ * their reference bit (entry->freq). The hand clears the bits it passes
+ * and evicts the first entry without one; new entries go right behind it.
+ */
+typedef struct clock_state {
+	cache_queue circle;
+	entry *hand;            /* NULL stands for the head of the circle */
+} clock_state;
+
+static void clock_init(lru_cache *cache)
+{
+	cache->policy_state = calloc(1, sizeof(clock_state));
+	DIE(cache->policy_state == NULL, "calloc failed");
+}
+
+static void clock_free(lru_cache *cache)
+{
+	free(cache->policy_state);
+}
+
+static void clock_remove(lru_cache *cache, entry *e)
+{
+	clock_state *c = cache->policy_state;
+
+	if (c->hand == e) {
+		c->hand = e->next;
+	}
+
+	queue_unlink(&c->circle, e);
+}
+
+static entry *clock_evict(lru_cache *cache)
+{
+	clock_state *c = cache->policy_state;
+
+	for (;;) {
+		entry *e = c->hand ? c->hand : c->circle.head;
+
+		if (!e->freq) {
+			clock_remove(cache, e);
+			return e;
+		}
+
+		e->freq = 0;
+		c->hand = e->next;
+	}
+}
+
+static void clock_insert(lru_cache *cache, entry *e)
+{
+	clock_state *c = cache->policy_state;
+	entry *hand = c->hand;
+
+	e->freq = 0;
+
+	if (!hand) {
+		queue_push(&c->circle, e, QUEUE_MAIN);
+		return;
+	}
+
+	// Link it just before the hand, so it is the last one visited
+	e->queue = QUEUE_MAIN;
+	e->next = hand;
+	e->prev = hand->prev;
+
+	if (hand->prev) {
+		hand->prev->next = e;
+	} else {
+		c->circle.head = e;
+	}
+
+	hand->prev = e;
+	c->circle.size++;
+}
+
+static void clock_hit(lru_cache *cache, entry *e)
+{
+	(void)cache;
+	e->freq = 1;
+}
+
+/*
+ * Referenced entries first, then the others; within each group the hand
+ * reaches the newest ones last, so they come first.
+ */
+static unsigned int clock_rank(lru_cache *cache, entry **entries)
+{
+	clock_state *c = cache->policy_state;
+	entry *newest = c->hand && c->hand->prev ? c->hand->prev
+											 : c->circle.tail;
+	unsigned int count = 0;
+
+	for (int referenced = 1; referenced >= 0; referenced--) {
+		entry *e = newest;
+
+		for (unsigned int i = 0; i < c->circle.size; i++) {
+			if ((e->freq != 0) == referenced) {
+				entries[count++] = e;
+			}
+			e = e->prev ? e->prev : c->circle.tail;
+		}
+	}
+
+	return count;
+}
+
+/*
+ * S3-FIFO: new entries go through a small FIFO holding a tenth of the cache.
+ * Those accessed again while there move to the main FIFO, the others are
+ * evicted and remembered in a ghost list; a key found in the ghost list
+ * goes straight to the main FIFO. Main entries with hits get reinserted
+ * (spending one hit) instead of being evicted.
+ */
+typedef struct s3fifo_state {
+	cache_queue small;
+	cache_queue main;
+	ghost_list ghost;
+	unsigned int small_target;
+	bool ghost_hit;         /* Whether the key being inserted was a ghost */
+} s3fifo_state;
+
+static void s3fifo_init(lru_cache *cache)
+{
+	s3fifo_state *s = calloc(1, sizeof(s3fifo_state));
+	DIE(s == NULL, "calloc failed");
+
+	s->small_target = cache->capacity / 10 ? cache->capacity / 10 : 1;
+	ghost_init(&s->ghost, cache->capacity);
+	cache->policy_state = s;
+}
+
+static void s3fifo_free(lru_cache *cache)
+{
+	s3fifo_state *s = cache->policy_state;
+
+	ghost_free(&s->ghost);
+	free(s);
+}
+
+static void s3fifo_miss(lru_cache *cache, unsigned int hash)
+{
+	s3fifo_state *s = cache->policy_state;
+
+	s->ghost_hit = ghost_remove(&s->ghost, hash);
+}
+
+static entry *s3fifo_evict(lru_cache *cache)
+{
+	s3fifo_state *s = cache->policy_state;
+
+	for (;;) {
+		entry *e;
+
+		if (s->small.size > 0 &&
+			(s->small.size >= s->small_target || s->main.size == 0)) {
+			e = queue_pop(&s->small);
+
+			if (e->freq > 1) {
+				e->freq = 0;
+				queue_push(&s->main, e, QUEUE_MAIN);
+				continue;
+			}
+
+			ghost_push(&s->ghost, e->hash);
+			return e;
+		}
+
+		e = queue_pop(&s->main);
+		if (e->freq > 0) {
+			e->freq--;
+			queue_push(&s->main, e, QUEUE_MAIN);
+			continue;
+		}
+
+		return e;
+	}
+}
+
+static void s3fifo_insert(lru_cache *cache, entry *e)
+{
+	s3fifo_state *s = cache->policy_state;
+
+	e->freq = 0;
+	if (s->ghost_hit) {
+		queue_push(&s->main, e, QUEUE_MAIN);
+	} else {
+		queue_push(&s->small, e, QUEUE_SMALL);
+	}
+
+	s->ghost_hit = false;
+}
+
+static void s3fifo_hit(lru_cache *cache, entry *e)
+{
+	(void)cache;
+	if (e->freq < S3FIFO_MAX_FREQ) {
+		e->freq++;
+	}
+}
+
+static void s3fifo_remove(lru_cache *cache, entry *e)
+{
+	s3fifo_state *s = cache->policy_state;
+
+	queue_unlink(e->queue == QUEUE_SMALL ? &s->small : &s->main, e);
+}
+
+static unsigned int s3fifo_rank(lru_cache *cache, entry **entries)
+{
+	s3fifo_state *s = cache->policy_state;
+	unsigned int count = queue_rank(&s->main, entries);
+
+	return count + queue_rank(&s->small, entries + count);
+}
+
+/*
+ * ARC: T1 holds entries seen once recently, T2 entries seen at least twice,
+ * and the ghost lists B1 and B2 the keys last evicted from each. Ghost hits
+ * move the target size p of T1 towards the list which would have kept the
+ * key, and the key then joins T2.
+ */
+typedef struct arc_state {
+	cache_queue t1;
+	cache_queue t2;
+	ghost_list b1;
+	ghost_list b2;
+	unsigned int p;
+	unsigned char pending;  /* Ghost list of the key being inserted */
+} arc_state;
+
+static void arc_init(lru_cache *cache)
+{
+	arc_state *a = calloc(1, sizeof(arc_state));
+	DIE(a == NULL, "calloc failed");
+
+	ghost_init(&a->b1, cache->capacity);
+	ghost_init(&a->b2, cache->capacity);
+	cache->policy_state = a;
+}
+
+static void arc_free(lru_cache *cache)
+{
+	arc_state *a = cache->policy_state;
+
+	ghost_free(&a->b1);
+	ghost_free(&a->b2);
+	free(a);
+}
+
+static void arc_miss(lru_cache *cache, unsigned int hash)
+{
+	arc_state *a = cache->policy_state;
+	unsigned int delta;
+
+	a->pending = QUEUE_NONE;
+
+	if (ghost_contains(&a->b1, hash)) {
+		delta = a->b2.size > a->b1.size ? a->b2.size / a->b1.size : 1;
+		a->p = a->p + delta < cache->capacity ? a->p + delta
+											  : cache->capacity;
+		ghost_remove(&a->b1, hash);
+		a->pending = QUEUE_T1;
+	} else if (ghost_contains(&a->b2, hash)) {
+		delta = a->b1.size > a->b2.size ? a->b1.size / a->b2.size : 1;
+		a->p = a->p > delta ? a->p - delta : 0;
+		ghost_remove(&a->b2, hash);
+		a->pending = QUEUE_T2;
+	}
+}
+
+static entry *arc_replace(arc_state *a)
+{
+	entry *e;
+
+	if (a->t1.size > 0 && (a->t1.size > a->p ||
+		(a->pending == QUEUE_T2 && a->t1.size == a->p) || a->t2.size == 0)) {
+		e = queue_pop(&a->t1);
+		ghost_push(&a->b1, e->hash);
+	} else {
+		e = queue_pop(&a->t2);
+		ghost_push(&a->b2, e->hash);
+	}
+
+	return e;
+}
+
+static entry *arc_evict(lru_cache *cache)
+{
+	arc_state *a = cache->policy_state;
+	unsigned int c = cache->capacity;
+
+	if (a->pending != QUEUE_NONE) {
+		return arc_replace(a);
+	}
+
+	// A brand new key: keep |T1| + |B1| <= c and the whole directory <= 2c
+	if (a->t1.size + a->b1.size >= c) {
+		if (a->t1.size < c) {
+			ghost_pop(&a->b1);
+			return arc_replace(a);
+		}
+
+		return queue_pop(&a->t1);
+	}
+
+	if (a->t1.size + a->t2.size + a->b1.size + a->b2.size >= 2 * c) {
+		ghost_pop(&a->b2);
+	}
+
+	return arc_replace(a);
+}
+
+static void arc_insert(lru_cache *cache, entry *e)
+{
+	arc_state *a = cache->policy_state;
+	unsigned int c = cache->capacity;
+
+	if (a->pending != QUEUE_NONE) {
+		queue_push(&a->t2, e, QUEUE_T2);
+	} else {
+		queue_push(&a->t1, e, QUEUE_T1);
+	}
+	a->pending = QUEUE_NONE;
+
+	// Removed entries may leave the ghost lists longer than allowed
+	while (a->t1.size + a->b1.size > c && a->b1.size > 0) {
+		ghost_pop(&a->b1);
+	}
+	while (a->t1.size + a->t2.size + a->b1.size + a->b2.size > 2 * c &&
+		   a->b2.size > 0) {
+		ghost_pop(&a->b2);
+	}
+}
+
+static void arc_hit(lru_cache *cache, entry *e)
+{
+	arc_state *a = cache->policy_state;
+
+	queue_unlink(e->queue == QUEUE_T1 ? &a->t1 : &a->t2, e);
+	queue_push(&a->t2, e, QUEUE_T2);
+}
+
+static void arc_remove(lru_cache *cache, entry *e)
+{
+	arc_state *a = cache->policy_state;
+
+	queue_unlink(e->queue == QUEUE_T1 ? &a->t1 : &a->t2, e);
+}
+
+static unsigned int arc_rank(lru_cache *cache, entry **entries)
+{
+	arc_state *a = cache->policy_state;
+	unsigned int count = queue_rank(&a->t2, entries);
+
+	return count + queue_rank(&a->t1, entries + count);
+}
+
+/*
+ * W-TinyLFU: new entries wait in a small LRU window (1% of the cache). The
+ * entry leaving the window is admitted into the main segmented LRU only if
+ * the sketch says it is used more often than the main victim it replaces.
+ * Main entries start in probation and a hit promotes them to the protected
+ * segment (80% of the main part), which demotes its oldest entry if full.
+ */
+typedef struct tinylfu_state {
+	cache_queue window;
+	cache_queue probation;
+	cache_queue protected;
+	frequency_sketch sketch;
+	unsigned int window_target;
+	unsigned int protected_target;
+} tinylfu_state;
+
+static void tinylfu_init(lru_cache *cache)
+{
+	tinylfu_state *t = calloc(1, sizeof(tinylfu_state));
+	DIE(t == NULL, "calloc failed");
+
+	t->window_target = cache->capacity / 100 ? cache->capacity / 100 : 1;
+	t->protected_target = (cache->capacity - t->window_target) * 4 / 5;
+	sketch_init(&t->sketch, cache->capacity);
+	cache->policy_state = t;
+}
+
+static void tinylfu_free(lru_cache *cache)
+{
+	tinylfu_state *t = cache->policy_state;
+
+	sketch_free(&t->sketch);
+	free(t);
+}
+
+static cache_queue *tinylfu_queue(tinylfu_state *t, entry *e)
+{
+	switch (e->queue) {
+	case QUEUE_WINDOW:
+		return &t->window;
+	case QUEUE_PROBATION:
+		return &t->probation;
+	default:
+		return &t->protected;
+	}
+}
+
+static void tinylfu_miss(lru_cache *cache, unsigned int hash)
+{
+	tinylfu_state *t = cache->policy_state;
+
+	sketch_increment(&t->sketch, hash);
+}
+
+static entry *tinylfu_evict(lru_cache *cache)
+{
+	tinylfu_state *t = cache->policy_state;
+	entry *candidate = t->window.head;
+	entry *victim = t->probation.head ? t->probation.head
+									  : t->protected.head;
+
+	// Only one of the regions has entries, or the window is below its share
+	if (!victim || (candidate && t->window.size >= t->window_target &&
+		sketch_estimate(&t->sketch, candidate->hash) <=
+		sketch_estimate(&t->sketch, victim->hash))) {
+		queue_unlink(&t->window, candidate);
+		return candidate;
+	}
+
+	if (candidate && t->window.size >= t->window_target) {
+		// The candidate wins and takes the victim's place
+		queue_unlink(&t->window, candidate);
+		queue_push(&t->probation, candidate, QUEUE_PROBATION);
+	}
+
+	queue_unlink(tinylfu_queue(t, victim), victim);
+	return victim;
+}
+
+static void tinylfu_insert(lru_cache *cache, entry *e)
+{
+	tinylfu_state *t = cache->policy_state;
+
+	queue_push(&t->window, e, QUEUE_WINDOW);
+
+	// While the cache fills up, the window overflows into probation
+	if (t->window.size > t->window_target) {
+		entry *oldest = queue_pop(&t->window);
+
+		queue_push(&t->probation, oldest, QUEUE_PROBATION);
+	}
+}
+
+static void tinylfu_hit(lru_cache *cache, entry *e)
+{
+	tinylfu_state *t = cache->policy_state;
+
+	sketch_increment(&t->sketch, e->hash);
+
+	if (e->queue == QUEUE_PROBATION) {
+		queue_unlink(&t->probation, e);
+		queue_push(&t->protected, e, QUEUE_PROTECTED);
+
+		if (t->protected.size > t->protected_target) {
+			entry *demoted = queue_pop(&t->protected);
+
+			queue_push(&t->probation, demoted, QUEUE_PROBATION);
+		}
+	} else {
+		queue_move_to_tail(tinylfu_queue(t, e), e);
+	}
+}
+
+static void tinylfu_remove(lru_cache *cache, entry *e)
+{
+	tinylfu_state *t = cache->policy_state;
+
+	queue_unlink(tinylfu_queue(t, e), e);
+}
+
+static unsigned int tinylfu_rank(lru_cache *cache, entry **entries)
+{
+	tinylfu_state *t = cache->policy_state;
+	unsigned int count = queue_rank(&t->protected, entries);
+
+	count += queue_rank(&t->window, entries + count);
+	return count + queue_rank(&t->probation, entries + count);
+}
+
+const cache_policy_ops cache_policies[] = {
+	[CACHE_POLICY_LRU] = {
+		lru_init, lru_free, NULL,
+		lru_evict, lru_insert, lru_hit, lru_remove,
+		lru_rank
+	},
+	[CACHE_POLICY_CLOCK] = {
+		clock_init, clock_free, NULL,
+		clock_evict, clock_insert, clock_hit, clock_remove,
+		clock_rank
+	},
+	[CACHE_POLICY_S3FIFO] = {
+		s3fifo_init, s3fifo_free, s3fifo_miss,
+		s3fifo_evict, s3fifo_insert, s3fifo_hit, s3fifo_remove,
+		s3fifo_rank
+	},
+	[CACHE_POLICY_ARC] = {
+		arc_init, arc_free, arc_miss,
+		arc_evict, arc_insert, arc_hit, arc_remove,
+		arc_rank
+	},
+	[CACHE_POLICY_TINYLFU] = {
+		tinylfu_init, tinylfu_free, tinylfu_miss,
+		tinylfu_evict, tinylfu_insert, tinylfu_hit, tinylfu_remove,
+		tinylfu_rank
+	},
+};
+
+cache_policy_type get_cache_policy_type(const char *name)
+{
+	if (!name[0] || !strcmp(name, LRU_POLICY))
+		return CACHE_POLICY_LRU;
+	if (!strcmp(name, CLOCK_POLICY))
+		return CACHE_POLICY_CLOCK;
+	if (!strcmp(name, S3FIFO_POLICY))
+		return CACHE_POLICY_S3FIFO;
+	if (!strcmp(name, ARC_POLICY))
+		return CACHE_POLICY_ARC;
+	if (!strcmp(name, TINYLFU_POLICY))
+		return CACHE_POLICY_TINYLFU;
+
+	DIE(1, "unknown cache policy");
+	return CACHE_POLICY_LRU;
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef CACHE_POLICY_H
+#define CACHE_POLICY_H
+
+#define LRU_POLICY              "LRU"
+#define CLOCK_POLICY            "CLOCK"
+#define S3FIFO_POLICY           "S3FIFO"
+#define ARC_POLICY              "ARC"
+#define TINYLFU_POLICY          "TINYLFU"
+
+typedef enum cache_policy_type {
+	CACHE_POLICY_LRU,
+	CACHE_POLICY_CLOCK,
+	CACHE_POLICY_S3FIFO,
+	CACHE_POLICY_ARC,
+	CACHE_POLICY_TINYLFU
+} cache_policy_type;
+
+typedef struct entry entry;
+typedef struct lru_cache lru_cache;
+
+/*
+ * Operations every cache replacement policy implements. The cache keeps the
+ * key -> entry map; the policy orders the entries it was given (through
+ * their next/prev links and their queue/freq fields) and decides which one
+ * to evict. A key which is not cached is announced with miss() before it
+ * is inserted; evict() is only called when the cache is full, between the
+ * two, and must unlink the entry it returns. rank() lists the cached
+ * entries from the one most worth keeping to the next victims, without
+ * changing any state.
+ */
+typedef struct cache_policy_ops {
+	void (*init)(lru_cache *cache);
+	void (*free)(lru_cache *cache);
+	void (*miss)(lru_cache *cache, unsigned int hash);
+	entry *(*evict)(lru_cache *cache);
+	void (*insert)(lru_cache *cache, entry *entry);
+	void (*hit)(lru_cache *cache, entry *entry);
+	void (*remove)(lru_cache *cache, entry *entry);
+	unsigned int (*rank)(lru_cache *cache, entry **entries);
+} cache_policy_ops;
+
+extern const cache_policy_ops cache_policies[];
+
+/**
+ * get_cache_policy_type() - Finds the policy with the given name (e.g.
+ *      "S3FIFO"). An empty name selects LRU.
+ */
+cache_policy_type get_cache_policy_type(const char *name);
+
+#endif /* CACHE_POLICY_H */
@@ -28,6 +28,7 @@
 
 #define LOG_FAULT       "Document %s doesn't exist"
 #define LOG_LAZY_EXEC   "Task queue size is %d"
+#define LOG_PENDING     "Pending EDIT for %s"
 
 
 typedef enum request_type {
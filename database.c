@@ -6,81 +6,464 @@
 #include "utils.h"
 #include "server.h"
 
-void db_put(db *db, void *key, void *value) {
-	entry *entry = calloc(1, sizeof(struct entry));
-	DIE(entry == NULL, "calloc failed");
+static entry **db_alloc_map(unsigned int capacity) {
+	entry **map = calloc(capacity, sizeof(entry *));
+	DIE(map == NULL, "calloc failed");
 
-	entry->key = calloc(DOC_NAME_LENGTH, sizeof(char));
-	DIE(entry->key == NULL, "calloc failed");
-	memcpy(entry->key, key, DOC_NAME_LENGTH);
+	return map;
+}
+
+static unsigned int db_order_bucket(unsigned int bits, unsigned int hash) {
+	return hash >> (32 - bits);
+}
+
+static void db_order_link(entry **order, unsigned int bits, entry *entry) {
+	struct entry **bucket = &order[db_order_bucket(bits, entry->hash)];
+
+	entry->order_prev = NULL;
+	entry->order_next = *bucket;
+	if (*bucket) {
+		(*bucket)->order_prev = entry;
+	}
+	*bucket = entry;
+}
+
+static void db_order_unlink(db *db, entry *entry) {
+	if (entry->order_prev) {
+		entry->order_prev->order_next = entry->order_next;
+	} else {
+		db->order[db_order_bucket(db->order_bits, entry->hash)] =
+			entry->order_next;
+	}
+
+	if (entry->order_next) {
+		entry->order_next->order_prev = entry->order_prev;
+	}
+}
+
+/*
+ * Rebuilds the order buckets with one more or one less bit of the hash,
+ * keeping about DB_ORDER_LOAD entries per bucket. Not while iterating,
+ * since a range iterator walks the buckets by index.
+ */
+static void db_order_check_resize(db *db) {
+	unsigned int bits = db->order_bits;
+	unsigned int buckets = 1u << bits;
+
+	if (db->iterators > 0) {
+		return;
+	}
+
+	if (db->size > buckets * DB_ORDER_LOAD && bits < 31) {
+		bits++;
+	} else if (db->size < buckets / 2 && bits > DB_ORDER_MIN_BITS) {
+		bits--;
+	} else {
+		return;
+	}
+
+	entry **order = calloc(1u << bits, sizeof(entry *));
+	DIE(order == NULL, "calloc failed");
+
+	for (unsigned int i = 0; i < buckets; i++) {
+		entry *entry = db->order[i];
+
+		while (entry) {
+			struct entry *next = entry->order_next;
+
+			db_order_link(order, bits, entry);
+			entry = next;
+		}
+	}
+
+	free(db->order);
+	db->order = order;
+	db->order_bits = bits;
+}
+
+db *init_db(slab_allocator *slab, db_engine engine) {
+	db *db = calloc(1, sizeof(struct db));
+	DIE(db == NULL, "calloc failed");
+
+	db->engine = engine;
+	if (engine == DB_SWISS) {
+		swiss_init(&db->swiss, SWISS_MIN_CAPACITY);
+	} else {
+		db->map = db_alloc_map(DB_MIN_BUCKETS);
+		db->capacity = DB_MIN_BUCKETS;
+	}
+	db->size = 0;
+	db->slab = slab;
+
+	db->order = db_alloc_map(1u << DB_ORDER_MIN_BITS);
+	db->order_bits = DB_ORDER_MIN_BITS;
+
+	return db;
+}
+
+static bool db_is_rehashing(db *db) {
+	return db->rehash_map != NULL;
+}
+
+/*
+ * Moves up to `buckets` non-empty buckets of the old table into the new
+ * one, visiting at most 10 times as many empty buckets, so a single
+ * operation never pays for the whole resize.
+ */
+static void db_rehash_step(db *db, unsigned int buckets) {
+	unsigned int empty_visits = buckets * 10;
+
+	if (!db_is_rehashing(db) || db->iterators > 0) {
+		return;
+	}
+
+	while (buckets > 0 && db->rehash_index < db->capacity) {
+		entry *entry = db->map[db->rehash_index];
+
+		if (!entry) {
+			db->rehash_index++;
+			if (--empty_visits == 0) {
+				return;
+			}
+			continue;
+		}
+
+		while (entry) {
+			struct entry *next = entry->next_hash;
+			unsigned int bucket = entry->hash % db->rehash_capacity;
+
+			entry->next_hash = db->rehash_map[bucket];
+			db->rehash_map[bucket] = entry;
+			entry = next;
+		}
+
+		db->map[db->rehash_index++] = NULL;
+		buckets--;
+	}
+
+	// Every bucket was moved: the new table becomes the main one
+	if (db->rehash_index == db->capacity) {
+		free(db->map);
+		db->map = db->rehash_map;
+		db->capacity = db->rehash_capacity;
+		db->rehash_map = NULL;
+		db->rehash_capacity = 0;
+		db->rehash_index = 0;
+	}
+}
+
+/* Starts growing or shrinking the table when the load factor asks for it */
+static void db_check_resize(db *db) {
+	unsigned int capacity = db->capacity;
+
+	if (db_is_rehashing(db) || db->iterators > 0) {
+		return;
+	}
+
+	if (db->size > capacity * DB_MAX_LOAD_FACTOR) {
+		capacity *= 2;
+	} else if (db->size < capacity / DB_MIN_LOAD_DIVISOR &&
+			   capacity / 2 >= DB_MIN_BUCKETS) {
+		capacity /= 2;
+	} else {
+		return;
+	}
 
-	entry->value = calloc(DOC_CONTENT_LENGTH, sizeof(char));
-	DIE(entry->value == NULL, "calloc failed");
-	memcpy(entry->value, value, DOC_CONTENT_LENGTH);
+	db->rehash_map = db_alloc_map(capacity);
+	db->rehash_capacity = capacity;
+	db->rehash_index = 0;
+}
+
+/*
+ * Buckets which may hold the key: its bucket in the main table and, during a
+ * resize, its bucket in the new table. Returns how many there are.
+ */
+static unsigned int db_buckets(db *db, unsigned int hash, entry ***buckets) {
+	unsigned int count = 0;
+	unsigned int bucket = hash % db->capacity;
+
+	// Buckets before rehash_index were already moved and are empty
+	if (!db_is_rehashing(db) || bucket >= db->rehash_index) {
+		buckets[count++] = &db->map[bucket];
+	}
+
+	if (db_is_rehashing(db)) {
+		buckets[count++] = &db->rehash_map[hash % db->rehash_capacity];
+	}
+
+	return count;
+}
 
-	unsigned int hash = hash_string(key) % db->capacity;
-	entry->next_hash = db->map[hash];
-	db->map[hash] = entry;
+entry *db_put(db *db, unsigned int hash, void *key, void *value,
+			  unsigned int value_len) {
+	doc_value *doc = doc_value_create(db->slab, value, value_len);
+	entry *entry = entry_create(db->slab, hash, key, doc);
+
+	// The entry holds the only reference
+	doc_value_release(db->slab, doc);
+
+	db_adopt(db, entry);
+
+	return entry;
+}
+
+void db_adopt(db *db, entry *entry) {
+	struct entry **bucket;
+
+	db_order_link(db->order, db->order_bits, entry);
+
+	if (db->engine == DB_SWISS) {
+		swiss_insert(&db->swiss, entry->hash, entry);
+		db->size++;
+		db_order_check_resize(db);
+		return;
+	}
+
+	db_rehash_step(db, DB_REHASH_STEP);
+
+	// New entries go straight to the new table during a resize
+	if (db_is_rehashing(db)) {
+		bucket = &db->rehash_map[entry->hash % db->rehash_capacity];
+	} else {
+		bucket = &db->map[entry->hash % db->capacity];
+	}
+
+	entry->next_hash = *bucket;
+	*bucket = entry;
 
 	db->size++;
+	db_check_resize(db);
+	db_order_check_resize(db);
+}
+
+void *db_get(db *db, unsigned int hash, void *key) {
+	entry *entry = db_get_entry(db, hash, key);
+
+	return entry ? entry->doc->data : NULL;
 }
 
-void *db_get(db *db, void *key) {
-	unsigned int hash = hash_string(key) % db->capacity;
-	entry *entry = db->map[hash];
+entry *db_get_entry(db *db, unsigned int hash, void *key) {
+	entry **buckets[2];
 
-	while (entry != NULL) {
-		if (entry->key) {
-			if (strcmp((char *)entry->key, (char *)key) == 0) {
-				return entry->value;
+	if (db->engine == DB_SWISS) {
+		return swiss_find(&db->swiss, hash, key);
+	}
+
+	db_rehash_step(db, DB_REHASH_STEP);
+
+	unsigned int count = db_buckets(db, hash, buckets);
+	for (unsigned int i = 0; i < count; i++) {
+		for (entry *entry = *buckets[i]; entry; entry = entry->next_hash) {
+			if (entry_matches(entry, hash, key)) {
+				return entry;
 			}
 		}
-		entry = entry->next_hash;
 	}
 
 	return NULL;
 }
 
 void db_remove(db *db, unsigned int hash, void *key) {
-	entry *entry = db->map[hash];
-	struct entry *prev = NULL;
-
-	while (entry) {
-		if (strcmp((char *)entry->key, (char *)key) == 0) {
-			if (prev) {
-				prev->next_hash = entry->next_hash;
-			} else {
-				db->map[hash] = entry->next_hash;
+	entry *entry = db_take(db, hash, key);
+
+	if (entry) {
+		entry_destroy(db->slab, entry);
+	}
+}
+
+entry *db_take(db *db, unsigned int hash, void *key) {
+	entry **buckets[2];
+
+	if (db->engine == DB_SWISS) {
+		entry *entry = swiss_erase(&db->swiss, hash, key);
+
+		if (entry) {
+			db->size--;
+			db_order_unlink(db, entry);
+
+			// Never move slots under a running iterator
+			if (db->iterators == 0) {
+				swiss_shrink(&db->swiss);
+			}
+			db_order_check_resize(db);
+		}
+		return entry;
+	}
+
+	db_rehash_step(db, DB_REHASH_STEP);
+
+	unsigned int count = db_buckets(db, hash, buckets);
+	for (unsigned int i = 0; i < count; i++) {
+		for (entry **slot = buckets[i]; *slot; slot = &(*slot)->next_hash) {
+			entry *entry = *slot;
+
+			if (entry_matches(entry, hash, key)) {
+				*slot = entry->next_hash;
+				db->size--;
+				db_order_unlink(db, entry);
+
+				db_check_resize(db);
+				db_order_check_resize(db);
+				return entry;
 			}
+		}
+	}
+
+	return NULL;
+}
+
+void db_iter_init(db_iterator *it, db *db) {
+	it->db = db;
+	it->table = 0;
+	it->bucket = 0;
+	it->next = NULL;
+
+	// Entries must not move between tables while being iterated
+	db->iterators++;
+}
+
+entry *db_iter_next(db_iterator *it) {
+	db *db = it->db;
+
+	// Slots only change state when removed, which leaves the rest in place
+	if (db->engine == DB_SWISS) {
+		while (it->bucket < db->swiss.capacity) {
+			unsigned int slot = it->bucket++;
 
-			if (entry->next_hash) {
-				entry->next_hash->prev_hash = prev;
+			if (db->swiss.ctrl[slot] >= 0) {
+				return db->swiss.slots[slot];
 			}
+		}
 
-			db->size--;
+		return NULL;
+	}
+
+	while (!it->next) {
+		entry **map = it->table == 0 ? db->map : db->rehash_map;
+		unsigned int capacity = it->table == 0 ? db->capacity
+											   : db->rehash_capacity;
 
-			free(entry->key);
-			free(entry->value);
-			free(entry);
-			return;
+		if (it->bucket >= capacity) {
+			if (it->table == 1 || !db_is_rehashing(db)) {
+				return NULL;
+			}
+
+			it->table = 1;
+			it->bucket = 0;
+			continue;
 		}
-		prev = entry;
-		entry = entry->next_hash;
+
+		it->next = map[it->bucket++];
 	}
+
+	// Remember the successor, so the caller may remove the current entry
+	entry *current = it->next;
+	it->next = current->next_hash;
+
+	return current;
 }
 
-void free_db(db **db) {
-	for (unsigned int i = 0; i < (*db)->capacity; i++) {
-		entry *entry = (*db)->map[i];
-		while (entry != NULL) {
-			struct entry *next = entry->next_hash;
-			free(entry->key);
-			free(entry->value);
-			free(entry);
-			entry = next;
+/* Catches up with the resizes put off while iterating */
+static void db_iteration_done(db *db) {
+	db->iterators--;
+
+	if (db->engine == DB_SWISS) {
+		if (db->iterators == 0) {
+			swiss_shrink(&db->swiss);
 		}
+	} else {
+		db_check_resize(db);
+	}
+	db_order_check_resize(db);
+}
+
+void db_iter_end(db_iterator *it) {
+	db_iteration_done(it->db);
+}
+
+static bool db_range_contains(db_range_iterator *it, unsigned int hash) {
+	if (it->to == 0 || it->from < it->to) {
+		return hash >= it->from && (it->to == 0 || hash < it->to);
+	}
+
+	return hash >= it->from || hash < it->to;
+}
+
+void db_range_init(db_range_iterator *it, db *db, unsigned int from,
+				   unsigned int to) {
+	unsigned int bits = db->order_bits;
+	unsigned int first = db_order_bucket(bits, from);
+	unsigned int last = db_order_bucket(bits, to - 1);
+
+	it->db = db;
+	it->from = from;
+	it->to = to;
+	it->bucket = first;
+	it->next = NULL;
+
+	if (from == to) {
+		it->buckets_left = 0;
+	} else if (to == 0 || from < to) {
+		it->buckets_left = last - first + 1;
+	} else if (last == first) {
+		// Wrapping around within one bucket covers all of them
+		it->buckets_left = 1u << bits;
+	} else {
+		it->buckets_left = last + (1u << bits) - first + 1;
+	}
+
+	// The buckets must stay as they are while being walked
+	db->iterators++;
+}
+
+entry *db_range_next(db_range_iterator *it) {
+	unsigned int mask = (1u << it->db->order_bits) - 1;
+
+	while (true) {
+		while (!it->next) {
+			if (it->buckets_left == 0) {
+				return NULL;
+			}
+
+			it->next = it->db->order[it->bucket];
+			it->bucket = (it->bucket + 1) & mask;
+			it->buckets_left--;
+		}
+
+		// Remember the successor, so the caller may remove the current entry
+		entry *current = it->next;
+		it->next = current->order_next;
+
+		if (db_range_contains(it, current->hash)) {
+			return current;
+		}
+	}
+}
+
+void db_range_end(db_range_iterator *it) {
+	db_iteration_done(it->db);
+}
+
+unsigned long db_index_bytes(db *db) {
+	unsigned long order_bytes = (1ul << db->order_bits) * sizeof(entry *);
+
+	if (db->engine == DB_SWISS) {
+		return order_bytes + (unsigned long)db->swiss.capacity *
+			   (1 + sizeof(entry *) + sizeof(unsigned int));
+	}
+
+	return order_bytes + (unsigned long)(db->capacity + db->rehash_capacity) *
+		   sizeof(entry *);
+}
+
+void free_db(db **db) {
+	// The entries are released together with the slab they live in
+	if ((*db)->engine == DB_SWISS) {
+		swiss_destroy(&(*db)->swiss);
 	}
 	free((*db)->map);
+	free((*db)->rehash_map);
+	free((*db)->order);
 	free(*db);
 	*db = NULL;
 }
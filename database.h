@@ -7,37 +7,135 @@
 
 #include "server.h"
 
+#define DB_MIN_BUCKETS          64
+#define DB_MAX_LOAD_FACTOR      1
+#define DB_MIN_LOAD_DIVISOR     8
+#define DB_REHASH_STEP          4
+
+#define DB_ORDER_MIN_BITS       4
+#define DB_ORDER_LOAD           4       /* Average entries per order bucket */
+
+/*
+ * Walks every entry of a database, in both tables during a resize (for a
+ * swiss table, bucket is the next slot to look at). The
+ * current entry may be removed while iterating; no rehash step is made
+ * until db_iter_end().
+ */
+typedef struct db_iterator {
+	db *db;
+	unsigned int table;
+	unsigned int bucket;
+	entry *next;
+} db_iterator;
+
+/*
+ * Walks the entries whose hash lies in [from, to), wrapping around past the
+ * largest hash when to < from (to == 0 stands for "up to the largest
+ * hash"). Only the order buckets covering the range are looked at. The
+ * current entry may be removed while iterating.
+ */
+typedef struct db_range_iterator {
+	db *db;
+	unsigned int from;
+	unsigned int to;
+	unsigned int bucket;
+	unsigned int buckets_left;
+	entry *next;
+} db_range_iterator;
+
+/**
+ * @brief Creates an empty database whose entries are allocated from the
+ *      given slab. With DB_CHAINED, the bucket array grows and shrinks with
+ *      the load factor, moving a few buckets per operation; with DB_SWISS,
+ *      the entries are indexed by an open-addressing swiss table, rebuilt
+ *      at once when it gets 7/8 full.
+ */
+db *init_db(slab_allocator *slab, db_engine engine);
+
 /**
  * @brief Puts a key-value pair in the database.
  *
  * @param db: Database where the key-value pair will be stored.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
  * @param value: Value of the pair.
+ * @param value_len: Length of the value, which is stored with its exact
+ *      size (plus a terminating NUL).
+ *
+ * @return - The new entry, whose value may then be shared with the cache.
  */
-void db_put(db *db, void *key, void *value);
+entry *db_put(db *db, unsigned int hash, void *key, void *value,
+			  unsigned int value_len);
 
 /**
  * @brief Retrieves the value associated with a key.
  *
  * @param db: Database where the key-value pair is stored.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
  *
  * @return - The value associated with the key,
  *      or NULL if the key is not found.
  */
-void *db_get(db *db, void *key);
+void *db_get(db *db, unsigned int hash, void *key);
+
+/**
+ * @brief Same as db_get(), but returns the whole entry, so its value
+ *      can be replaced in place.
+ */
+entry *db_get_entry(db *db, unsigned int hash, void *key);
 
 /**
  * @brief Removes a key-value pair from the database.
  *
  * @param db: Database where the key-value pair is stored.
- * @param hash: Hash of the key.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
  */
 void db_remove(db *db, unsigned int hash, void *key);
 
 /**
- * @brief Frees the database.
+ * @brief Same as db_remove(), but hands the entry to the caller instead of
+ *      freeing it, so it can be moved to another database as it is.
+ *
+ * @return - The unlinked entry, or NULL if the key is not found.
+ */
+entry *db_take(db *db, unsigned int hash, void *key);
+
+/**
+ * @brief Links an existing entry, taken from another database, into this
+ *      one. The key must not be present yet.
+ */
+void db_adopt(db *db, entry *entry);
+
+void db_iter_init(db_iterator *it, db *db);
+
+/**
+ * @brief Returns the next entry, or NULL once every entry was visited.
+ */
+entry *db_iter_next(db_iterator *it);
+
+void db_iter_end(db_iterator *it);
+
+void db_range_init(db_range_iterator *it, db *db, unsigned int from,
+				   unsigned int to);
+
+/**
+ * @brief Returns the next entry of the range, in no particular order, or
+ *      NULL once all of them were visited.
+ */
+entry *db_range_next(db_range_iterator *it);
+
+void db_range_end(db_range_iterator *it);
+
+/**
+ * @brief Bytes used by the index of the database, without its entries.
+ */
+unsigned long db_index_bytes(db *db);
+
+/**
+ * @brief Frees the database structure. Its entries belong to the slab
+ *      allocator, which has to be released separately.
  *
  * @param db: Database to be freed.
  */
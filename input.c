@@ -0,0 +1,155 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "utils.h"
+
+/*
+ * Reads a stream which cannot be mapped (a pipe, or an empty file) into a
+ * growing buffer, the way the JSONL reader fills its own.
+ */
+static void input_read_stream(input_file *in, int fd) {
+	size_t capacity = INPUT_STREAM_BUFFER_SIZE;
+
+	in->data = malloc(capacity);
+	DIE(in->data == NULL, "malloc failed");
+
+	while (true) {
+		if (in->size == capacity) {
+			capacity *= 2;
+			in->data = realloc(in->data, capacity);
+			DIE(in->data == NULL, "realloc failed");
+		}
+
+		ssize_t n = read(fd, in->data + in->size, capacity - in->size);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		DIE(n < 0, "read failed");
+
+		if (n == 0) {
+			break;
+		}
+		in->size += n;
+	}
+}
+
+input_file *open_input_file(const char *path) {
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	DIE(fd < 0, "missing input file");
+
+	DIE(fstat(fd, &st) < 0, "fstat failed");
+
+	input_file *in = calloc(1, sizeof(input_file));
+	DIE(in == NULL, "calloc failed");
+
+	// Only a regular file with some content can be mapped
+	if (!S_ISREG(st.st_mode) || st.st_size == 0) {
+		input_read_stream(in, fd);
+		close(fd);
+
+		return in;
+	}
+
+	in->size = st.st_size;
+	in->mapped = true;
+
+	// Private and writable: the quotes we overwrite never reach the file
+	in->data = mmap(NULL, in->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd,
+					0);
+	DIE(in->data == MAP_FAILED, "mmap failed");
+	close(fd);
+
+	madvise(in->data, in->size, MADV_SEQUENTIAL);
+
+	return in;
+}
+
+void close_input_file(input_file **in) {
+	if ((*in)->mapped) {
+		munmap((*in)->data, (*in)->size);
+	} else {
+		free((*in)->data);
+	}
+	free(*in);
+	*in = NULL;
+}
+
+/* Length of the current line, without its newline */
+static size_t input_line_length(input_file *in) {
+	char *newline = memchr(in->data + in->pos, '\n', in->size - in->pos);
+
+	return newline ? (size_t)(newline - in->data) - in->pos
+				   : in->size - in->pos;
+}
+
+bool input_peek(input_file *in, char *buffer, size_t size) {
+	if (in->pos >= in->size) {
+		return false;
+	}
+
+	size_t len = input_line_length(in);
+
+	if (len > size - 1) {
+		len = size - 1;
+	}
+
+	memcpy(buffer, in->data + in->pos, len);
+	buffer[len] = '\0';
+
+	return true;
+}
+
+bool input_read_line(input_file *in, char *buffer, size_t size) {
+	if (!input_peek(in, buffer, size)) {
+		return false;
+	}
+
+	input_skip_line(in);
+
+	return true;
+}
+
+char *input_quoted(input_file *in, unsigned int *len) {
+	char *open = memchr(in->data + in->pos, '"', in->size - in->pos);
+	DIE(open == NULL, "missing quoted string");
+
+	char *close = memchr(open + 1, '"', in->data + in->size - open - 1);
+	DIE(close == NULL, "document content is not properly quoted");
+
+	*close = '\0';
+	*len = close - open - 1;
+	in->pos = close + 1 - in->data;
+
+	return open + 1;
+}
+
+void input_skip_line(input_file *in) {
+	in->pos += input_line_length(in);
+
+	if (in->pos < in->size) {
+		in->pos++;
+	}
+}
+
+void input_release_consumed(input_file *in) {
+	size_t page = sysconf(_SC_PAGESIZE);
+	size_t end = in->pos / page * page;
+
+	// A buffer read from a stream is only given back as a whole
+	if (!in->mapped || end - in->released < INPUT_RELEASE_BYTES) {
+		return;
+	}
+
+	// Only the copies of the pages we wrote to take memory of our own
+	madvise(in->data + in->released, end - in->released, MADV_DONTNEED);
+	in->released = end;
+}
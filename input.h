@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Parsed bytes handed back to the kernel at once */
+#define INPUT_RELEASE_BYTES     (8UL << 20)
+
+/* First size of the buffer of an input which is read instead of mapped */
+#define INPUT_STREAM_BUFFER_SIZE    (1UL << 20)
+
+/*
+ * Input file mapped in memory and parsed in place. The mapping is private,
+ * so quoted strings are NUL-terminated by overwriting their closing quote
+ * and handed out as views into it instead of copies. Pipes and empty files
+ * are read whole into a buffer of our own instead.
+ */
+typedef struct input_file {
+	char *data;
+	size_t size;
+	bool mapped;            /* data is a mapping, not a malloc'd buffer */
+	size_t pos;             /* Next byte to parse */
+	size_t released;        /* Bytes before it were returned to the kernel */
+} input_file;
+
+/**
+ * open_input_file() - Maps the whole file for parsing, or reads it all into
+ *      memory if it is not a regular file with some content (e.g. a FIFO).
+ */
+input_file *open_input_file(const char *path);
+
+void close_input_file(input_file **in);
+
+/**
+ * input_read_line() - Copies the next line, without its newline, into
+ *      buffer (truncated to size - 1 bytes and NUL-terminated) and skips
+ *      past it.
+ *
+ * @return - false if the whole file was already parsed.
+ */
+bool input_read_line(input_file *in, char *buffer, size_t size);
+
+/**
+ * input_peek() - Copies at most size - 1 bytes of the current line into
+ *      buffer, NUL-terminated, without parsing them.
+ *
+ * @return - false if the whole file was already parsed.
+ */
+bool input_peek(input_file *in, char *buffer, size_t size);
+
+/**
+ * input_quoted() - Finds the next string between double quotes, which may
+ *      span several lines, and returns it as a NUL-terminated view into the
+ *      input. Parsing resumes right after its closing quote.
+ *
+ * @param len: RETURNS the length of the string.
+ */
+char *input_quoted(input_file *in, unsigned int *len);
+
+/**
+ * input_skip_line() - Skips the rest of the current line.
+ */
+void input_skip_line(input_file *in);
+
+/**
+ * input_release_consumed() - Lets the kernel drop the pages parsed so far,
+ *      once they add up to INPUT_RELEASE_BYTES. Every view returned before
+ *      becomes invalid. Does nothing for an input which was read, not
+ *      mapped.
+ */
+void input_release_consumed(input_file *in);
+
+#endif /* INPUT_H */
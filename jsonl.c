@@ -0,0 +1,366 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "jsonl.h"
+#include "utils.h"
+
+jsonl_reader *open_jsonl_reader(const char *path) {
+	jsonl_reader *reader = calloc(1, sizeof(jsonl_reader));
+	DIE(reader == NULL, "calloc failed");
+
+	if (!strcmp(path, "-")) {
+		reader->fd = STDIN_FILENO;
+	} else {
+		reader->fd = open(path, O_RDONLY);
+		DIE(reader->fd < 0, "missing input file");
+	}
+
+	// One more byte, so the data read so far is always NUL-terminated
+	reader->capacity = JSONL_BUFFER_SIZE;
+	reader->data = malloc(reader->capacity + 1);
+	DIE(reader->data == NULL, "malloc failed");
+	reader->data[0] = '\0';
+
+	return reader;
+}
+
+void close_jsonl_reader(jsonl_reader **reader) {
+	if ((*reader)->fd != STDIN_FILENO) {
+		close((*reader)->fd);
+	}
+
+	free((*reader)->data);
+	free(*reader);
+	*reader = NULL;
+}
+
+/*
+ * Returns the next line, without its newline, reading more of the stream
+ * when the buffer holds only part of it. The lines handed out before are
+ * overwritten.
+ */
+static char *jsonl_read_line(jsonl_reader *reader, size_t *len) {
+	while (true) {
+		char *line = reader->data + reader->pos;
+		size_t left = reader->len - reader->pos;
+		char *newline = memchr(line, '\n', left);
+
+		if (newline || (reader->eof && left > 0)) {
+			*len = newline ? (size_t)(newline - line) : left;
+			reader->pos += newline ? *len + 1 : left;
+			return line;
+		}
+
+		if (reader->eof) {
+			return NULL;
+		}
+
+		// Keep the partial line and make room after it
+		memmove(reader->data, line, left);
+		reader->len = left;
+		reader->pos = 0;
+
+		if (reader->len == reader->capacity) {
+			reader->capacity *= 2;
+			reader->data = realloc(reader->data, reader->capacity + 1);
+			DIE(reader->data == NULL, "realloc failed");
+		}
+
+		ssize_t n = read(reader->fd, reader->data + reader->len,
+						 reader->capacity - reader->len);
+		if (n < 0 && errno == EINTR) {
+			continue;
+		}
+		DIE(n < 0, "read failed");
+
+		reader->eof = n == 0;
+		reader->len += n;
+		reader->data[reader->len] = '\0';
+	}
+}
+
+static char *jsonl_skip_spaces(char *p, char *end) {
+	while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+		p++;
+	}
+
+	return p;
+}
+
+static unsigned int jsonl_hex4(char *p, char *end) {
+	unsigned int value = 0;
+
+	DIE(end - p < 4, "truncated \\u escape");
+	for (int i = 0; i < 4; i++) {
+		char c = p[i];
+
+		value <<= 4;
+		if (c >= '0' && c <= '9') {
+			value |= c - '0';
+		} else if ((c | 0x20) >= 'a' && (c | 0x20) <= 'f') {
+			value |= (c | 0x20) - 'a' + 10;
+		} else {
+			DIE(1, "invalid \\u escape");
+		}
+	}
+
+	return value;
+}
+
+/* Writes the code point as UTF-8 and returns the byte after it */
+static char *jsonl_put_utf8(char *dst, unsigned int code) {
+	if (code < 0x80) {
+		*dst++ = code;
+	} else if (code < 0x800) {
+		*dst++ = 0xC0 | (code >> 6);
+		*dst++ = 0x80 | (code & 0x3F);
+	} else if (code < 0x10000) {
+		*dst++ = 0xE0 | (code >> 12);
+		*dst++ = 0x80 | ((code >> 6) & 0x3F);
+		*dst++ = 0x80 | (code & 0x3F);
+	} else {
+		*dst++ = 0xF0 | (code >> 18);
+		*dst++ = 0x80 | ((code >> 12) & 0x3F);
+		*dst++ = 0x80 | ((code >> 6) & 0x3F);
+		*dst++ = 0x80 | (code & 0x3F);
+	}
+
+	return dst;
+}
+
+/*
+ * Unescapes the string starting at the opening quote p where it lies. An
+ * escape never takes fewer bytes than what it stands for, so the result,
+ * NUL-terminated, ends at the latest on the closing quote.
+ */
+static char *jsonl_string(char *p, char *end, char **str, unsigned int *len) {
+	char *dst = ++p;
+
+	*str = p;
+	while (true) {
+		DIE(p == end, "unterminated string");
+
+		if (*p == '"') {
+			break;
+		}
+
+		if (*p != '\\') {
+			*dst++ = *p++;
+			continue;
+		}
+
+		DIE(++p == end, "unterminated string");
+		switch (*p++) {
+		case '"': *dst++ = '"'; break;
+		case '\\': *dst++ = '\\'; break;
+		case '/': *dst++ = '/'; break;
+		case 'b': *dst++ = '\b'; break;
+		case 'f': *dst++ = '\f'; break;
+		case 'n': *dst++ = '\n'; break;
+		case 'r': *dst++ = '\r'; break;
+		case 't': *dst++ = '\t'; break;
+		case 'u': {
+			unsigned int code = jsonl_hex4(p, end);
+
+			p += 4;
+			// A surrogate pair stands for one code point past the BMP; half
+			// of a pair stands for nothing
+			DIE(code >= 0xDC00 && code < 0xE000, "unpaired surrogate");
+			if (code >= 0xD800 && code < 0xDC00) {
+				DIE(end - p < 6 || p[0] != '\\' || p[1] != 'u',
+					"unpaired surrogate");
+
+				unsigned int low = jsonl_hex4(p + 2, end);
+
+				DIE(low < 0xDC00 || low >= 0xE000, "unpaired surrogate");
+				code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+				p += 6;
+			}
+			dst = jsonl_put_utf8(dst, code);
+			break;
+		}
+		default:
+			DIE(1, "invalid escape");
+		}
+	}
+
+	*dst = '\0';
+	if (len) {
+		*len = dst - *str;
+	}
+
+	return p + 1;
+}
+
+/* Skips a value of any kind, nested objects and arrays included */
+static char *jsonl_skip_value(char *p, char *end) {
+	char *str;
+	int depth = 0;
+
+	do {
+		DIE(p == end, "missing value");
+
+		if (*p == '"') {
+			p = jsonl_string(p, end, &str, NULL);
+		} else if (*p == '{' || *p == '[') {
+			depth++;
+			p++;
+		} else if (*p == '}' || *p == ']') {
+			DIE(depth == 0, "malformed record");
+			depth--;
+			p++;
+		} else if (depth > 0) {
+			p++;
+		} else {
+			// A number or a literal, up to the next delimiter
+			while (p < end && *p != ',' && *p != '}' && *p != '"' &&
+				   *p != ' ' && *p != '\t' && *p != '\r') {
+				p++;
+			}
+		}
+	} while (depth > 0);
+
+	return p;
+}
+
+/* Number, or a string holding one, e.g. "server_id": 5 */
+static char *jsonl_number(char *p, char *end, long *value, bool *present) {
+	char *str = p, *after;
+
+	if (p < end && *p == '"') {
+		p = jsonl_string(p, end, &str, NULL);
+	}
+
+	errno = 0;
+	*value = strtol(str, &after, 10);
+	DIE(after == str, "invalid number");
+	DIE(errno == ERANGE, "number out of range");
+	*present = true;
+
+	return str == p ? after : p;
+}
+
+/* String value; null or any other kind of value leaves it NULL */
+static char *jsonl_string_value(char *p, char *end, char **str,
+								unsigned int *len) {
+	if (p < end && *p == '"') {
+		return jsonl_string(p, end, str, len);
+	}
+
+	return jsonl_skip_value(p, end);
+}
+
+/* Cache size given either as a number of entries or as a string */
+static char *jsonl_cache_size(char *p, char *end, jsonl_record *rec) {
+	if (p < end && *p == '"') {
+		return jsonl_string(p, end, &rec->cache_size, NULL);
+	}
+
+	char *start = p;
+
+	p = jsonl_skip_value(p, end);
+	DIE(p - start >= (long)sizeof(rec->number), "invalid cache size");
+	memcpy(rec->number, start, p - start);
+	rec->number[p - start] = '\0';
+	rec->cache_size = rec->number;
+
+	return p;
+}
+
+static void jsonl_parse(char *p, char *end, jsonl_record *rec) {
+	char *key;
+
+	p = jsonl_skip_spaces(p, end);
+	DIE(p == end || *p != '{', "record is not an object");
+	p = jsonl_skip_spaces(p + 1, end);
+
+	while (p < end && *p != '}') {
+		DIE(*p != '"', "missing key");
+		p = jsonl_string(p, end, &key, NULL);
+		p = jsonl_skip_spaces(p, end);
+		DIE(p == end || *p != ':', "missing ':'");
+		p = jsonl_skip_spaces(p + 1, end);
+
+		if (!strcmp(key, "type")) {
+			p = jsonl_string_value(p, end, &rec->type, NULL);
+		} else if (!strcmp(key, "doc")) {
+			p = jsonl_string_value(p, end, &rec->doc, &rec->doc_len);
+		} else if (!strcmp(key, "content")) {
+			p = jsonl_string_value(p, end, &rec->content, &rec->content_len);
+		} else if (!strcmp(key, "server_id")) {
+			p = jsonl_number(p, end, &rec->server_id, &rec->has_server_id);
+		} else if (!strcmp(key, "cache_size")) {
+			p = jsonl_cache_size(p, end, rec);
+		} else if (!strcmp(key, "weight")) {
+			p = jsonl_number(p, end, &rec->weight, &rec->has_weight);
+		} else if (!strcmp(key, "policy")) {
+			p = jsonl_string_value(p, end, &rec->policy, NULL);
+		} else if (!strcmp(key, "options")) {
+			p = jsonl_string_value(p, end, &rec->options, NULL);
+		} else {
+			p = jsonl_skip_value(p, end);
+		}
+
+		p = jsonl_skip_spaces(p, end);
+		if (p < end && *p == ',') {
+			p = jsonl_skip_spaces(p + 1, end);
+			DIE(p == end || *p == '}', "missing key");
+		} else {
+			DIE(p < end && *p != '}', "expected ','");
+		}
+	}
+
+	DIE(p == end, "unterminated record");
+	p = jsonl_skip_spaces(p + 1, end);
+	DIE(p != end, "trailing data after record");
+}
+
+bool jsonl_next(jsonl_reader *reader, jsonl_record *rec) {
+	char *line;
+	size_t len;
+
+	if (reader->replay) {
+		reader->replay = false;
+		*rec = reader->last;
+		return true;
+	}
+
+	// Blank lines are allowed between records
+	do {
+		line = jsonl_read_line(reader, &len);
+		if (!line) {
+			return false;
+		}
+	} while (jsonl_skip_spaces(line, line + len) == line + len);
+
+	jsonl_record *last = &reader->last;
+
+	memset(last, 0, sizeof(jsonl_record));
+	jsonl_parse(line, line + len, last);
+
+	*rec = *last;
+
+	return true;
+}
+
+void jsonl_read_options(jsonl_reader *reader, char *buffer, size_t size) {
+	jsonl_record rec;
+
+	buffer[0] = '\0';
+	if (!jsonl_next(reader, &rec)) {
+		return;
+	}
+
+	if (rec.type || !rec.options) {
+		reader->replay = true;
+		return;
+	}
+
+	strncpy(buffer, rec.options, size - 1);
+	buffer[size - 1] = '\0';
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef JSONL_H
+#define JSONL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Bytes read from the stream at once; a longer record grows the buffer */
+#define JSONL_BUFFER_SIZE       (1UL << 20)
+
+/*
+ * One JSON object per line, e.g.
+ *      {"type": "EDIT", "doc": "a.txt", "content": "Hello\n"}
+ * The strings are unescaped in place and handed out as NUL-terminated views
+ * into the reader's buffer; keys the load balancer does not know are
+ * skipped. A missing string is NULL and a missing number has its has_ flag
+ * cleared.
+ */
+typedef struct jsonl_record {
+	char *type;
+	char *doc;
+	unsigned int doc_len;
+	char *content;
+	unsigned int content_len;
+	long server_id;
+	bool has_server_id;
+	char *cache_size;       /* "10" or "64K"; numbers are copied below */
+	long weight;
+	bool has_weight;
+	char *policy;
+	char *options;          /* Header tokens, e.g. "ENABLE_VNODES 64" */
+
+	char number[24];
+} jsonl_record;
+
+/*
+ * Requests streamed from a file or a pipe through one buffer, so there is
+ * no need to know how many of them follow.
+ */
+typedef struct jsonl_reader {
+	int fd;
+	char *data;
+	size_t capacity;
+	size_t len;             /* Bytes read into data */
+	size_t pos;             /* Start of the next record */
+	bool eof;
+
+	jsonl_record last;
+	bool replay;            /* Hand out the last record again */
+} jsonl_reader;
+
+/**
+ * open_jsonl_reader() - Opens the file to stream, or the standard input
+ *      when path is "-".
+ */
+jsonl_reader *open_jsonl_reader(const char *path);
+
+void close_jsonl_reader(jsonl_reader **reader);
+
+/**
+ * jsonl_next() - Parses the next non-empty line. The views in the record
+ *      stay valid until the following call.
+ *
+ * @return - false at the end of the stream.
+ */
+bool jsonl_next(jsonl_reader *reader, jsonl_record *rec);
+
+/**
+ * jsonl_read_options() - Copies the "options" of a leading header record,
+ *      such as {"options": "ENABLE_VNODES 64 LAZY_GETS"}, into buffer
+ *      (truncated to size - 1 bytes). Any other first record is left for
+ *      jsonl_next() and buffer is cleared.
+ */
+void jsonl_read_options(jsonl_reader *reader, char *buffer, size_t size);
+
+#endif /* JSONL_H */
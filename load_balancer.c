@@ -2,12 +2,37 @@
  * Copyright (c) 2024, Negru Alexandru
  */
 
+#include <unistd.h>
+
 #include "load_balancer.h"
 #include "server.h"
 #include "utils.h"
 #include "database.h"
 
-load_balancer *init_load_balancer(bool enable_vnodes) {
+/*
+ * The load balancer whose responses are still buffered. A DIE() exits
+ * without freeing it, so they are printed from an atexit() hook instead.
+ */
+static load_balancer *live_main;
+static pthread_t live_main_thread;
+static bool flush_at_exit_registered;
+
+static void loader_flush_at_exit(void) {
+	// Only the thread driving the load balancer may touch its output
+	if (!live_main || !pthread_equal(pthread_self(), live_main_thread)) {
+		return;
+	}
+
+	// Requests already forwarded to the workers come first
+	if (live_main->workers) {
+		worker_pool_drain(live_main->workers);
+	}
+	output_flush(&live_main->out, STDOUT_FILENO);
+}
+
+load_balancer *init_load_balancer(bool enable_vnodes,
+								  unsigned int vnodes_count,
+								  placement_type placement_type) {
 	// Allocate memory for the load balancer
 	load_balancer *main = calloc(1, sizeof(load_balancer));
 	DIE(main == NULL, "calloc failed");
@@ -16,407 +41,725 @@ load_balancer *init_load_balancer(bool enable_vnodes) {
 	main->hash_function_servers = hash_uint;
 	main->hash_function_docs = hash_string;
 	main->enable_vnodes = enable_vnodes;
+	main->vnodes_count = enable_vnodes ? vnodes_count : 1;
+	if (main->vnodes_count == 0) {
+		main->vnodes_count = DEFAULT_VNODES_COUNT;
+	}
+	DIE(main->vnodes_count > MAX_VNODES_COUNT, "too many virtual nodes");
+
 	main->servers_count = 0;
+	main->placement = init_placement(placement_type, main->vnodes_count,
+									 main->hash_function_servers);
+
+	if (!flush_at_exit_registered) {
+		DIE(atexit(loader_flush_at_exit) != 0, "atexit failed");
+		flush_at_exit_registered = true;
+	}
+	live_main = main;
+	live_main_thread = pthread_self();
 
 	return main;
 }
 
-void loader_add_server(load_balancer* main, unsigned int server_id,
-					   unsigned int cache_size) {
-	// Check if the load balancer has virtual nodes
-	if (main->enable_vnodes) {
-		loader_add_server_vnodes(main, server_id, cache_size);
-	} else {
-		loader_add_server_no_vnodes(main, server_id, cache_size);
+void free_load_balancer(load_balancer** main) {
+	overflow_table *overflow = &(*main)->overflow;
+
+	// Print whatever the server threads still have to say, then stop them
+	if ((*main)->workers) {
+		worker_pool_drain((*main)->workers);
 	}
-}
 
-void loader_remove_server(load_balancer* main, unsigned int server_id) {
-	// Check if the load balancer has virtual nodes
-	if (main->enable_vnodes) {
-		loader_remove_server_vnodes(main, server_id);
-	} else {
-		loader_remove_server_no_vnodes(main, server_id);
+	for (unsigned int i = 0; i < (*main)->servers_count; i++) {
+		// Lazy GETs leave EDITs behind which still owe their responses
+		if ((*main)->servers[i]->lazy_gets) {
+			server_execute_all_requests((*main)->servers[i]);
+		}
+
+		if ((*main)->servers[i]->worker) {
+			worker_stop((*main)->servers[i]);
+		}
 	}
+
+	// Migrated entries may live in another server's slab, so nothing is
+	// freed before every server is done
+	for (unsigned int i = 0; i < (*main)->servers_count; i++) {
+		free_server(&(*main)->servers[i]);
+	}
+
+	if ((*main)->workers) {
+		free_worker_pool(&(*main)->workers);
+	}
+
+	output_flush(&(*main)->out, STDOUT_FILENO);
+	free((*main)->out.data);
+	if (live_main == *main) {
+		live_main = NULL;
+	}
+
+	for (unsigned int i = 0; i < overflow->capacity; i++) {
+		entry *entry = overflow->map[i];
+		while (entry) {
+			struct entry *next = entry->next_hash;
+			free(entry);
+			entry = next;
+		}
+	}
+	free(overflow->map);
+
+	free_placement(&(*main)->placement);
+	free((*main)->servers);
+	free(*main);
+
+	*main = NULL;
 }
 
-response *loader_forward_request(load_balancer* main, request *req) {
-	response *resp = NULL;
+void loader_enable_bounded_loads(load_balancer* main, double epsilon) {
+	DIE(main->placement->type != PLACEMENT_RING,
+		"bounded loads need the ring placement");
+	DIE(epsilon <= 0, "load epsilon must be positive");
+
+	main->bounded_loads = true;
+	main->load_epsilon = epsilon;
+}
+
+void loader_set_db_engine(load_balancer* main, db_engine db_engine) {
+	main->db_engine = db_engine;
+}
+
+void loader_enable_cache_admission(load_balancer* main) {
+	main->cache_admission = true;
+}
+
+void loader_enable_lazy_gets(load_balancer* main) {
+	main->lazy_gets = true;
+}
+
+void loader_enable_cache_handoff(load_balancer* main) {
+	main->cache_handoff = true;
+}
 
-	// Find the document hash
-	unsigned int doc_hash = main->hash_function_docs(req->doc_name);
+void loader_enable_workers(load_balancer* main) {
+	main->workers = init_worker_pool(&main->out);
 
-	// Find the server that should handle the request
 	for (unsigned int i = 0; i < main->servers_count; i++) {
-		if (main->servers[i]->hash_ring_position > doc_hash) {
-			resp = server_handle_request(main->servers[i], req);
-			return resp;
+		worker_start(main->servers[i]);
+	}
+}
+
+/*
+ * Waits until the server threads have handled every forwarded request, so
+ * the servers may be used from this thread.
+ */
+static void loader_sync_workers(load_balancer* main) {
+	if (main->workers) {
+		worker_pool_drain(main->workers);
+	}
+}
+
+static entry **overflow_find(overflow_table *overflow, unsigned int doc_hash,
+							 char *doc_name) {
+	if (overflow->size == 0) {
+		return NULL;
+	}
+
+	entry **slot = &overflow->map[doc_hash % overflow->capacity];
+
+	while (*slot) {
+		if (entry_matches(*slot, doc_hash, doc_name)) {
+			return slot;
 		}
+		slot = &(*slot)->next_hash;
 	}
 
-	// If the document hash is greater than the last server's
-	// hash_ring_position then the first server should handle the request
-	resp = server_handle_request(main->servers[0], req);
-	return resp;
+	return NULL;
 }
 
-void free_load_balancer(load_balancer** main) {
-	if ((*main)->enable_vnodes) {
-		for (unsigned int i = 0; i < (*main)->servers_count; i++) {
-			if ((*main)->servers[i]->server_id < 100000) {
-				free_server(&(*main)->servers[i]);
-			} else {
-				free_virtual_server(&(*main)->servers[i]);
+static void overflow_put(load_balancer* main, unsigned int doc_hash,
+						 char *doc_name, server *s) {
+	overflow_table *overflow = &main->overflow;
+
+	// Keep the chains short by doubling the table
+	if (overflow->size >= overflow->capacity) {
+		unsigned int capacity = overflow->capacity ?
+								2 * overflow->capacity : 64;
+		entry **map = calloc(capacity, sizeof(entry *));
+		DIE(map == NULL, "calloc failed");
+
+		for (unsigned int i = 0; i < overflow->capacity; i++) {
+			entry *entry = overflow->map[i];
+			while (entry) {
+				struct entry *next = entry->next_hash;
+				unsigned int bucket = entry->hash % capacity;
+				entry->next_hash = map[bucket];
+				map[bucket] = entry;
+				entry = next;
 			}
 		}
-		free(*main);
 
-		*main = NULL;
-	} else {
-		for (unsigned int i = 0; i < (*main)->servers_count; i++) {
-			free_server(&(*main)->servers[i]);
-		}
-		free(*main);
+		free(overflow->map);
+		overflow->map = map;
+		overflow->capacity = capacity;
+	}
+
+	entry *entry = calloc(1, sizeof(struct entry));
+	DIE(entry == NULL, "calloc failed");
 
-		*main = NULL;
+	strncpy(entry->key, doc_name, DOC_NAME_LENGTH);
+	entry->hash = doc_hash;
+	entry->value = s;
+
+	unsigned int bucket = doc_hash % overflow->capacity;
+	entry->next_hash = overflow->map[bucket];
+	overflow->map[bucket] = entry;
+	overflow->size++;
+}
+
+static void overflow_remove(load_balancer* main, unsigned int doc_hash,
+							char *doc_name) {
+	entry **slot = overflow_find(&main->overflow, doc_hash, doc_name);
+
+	if (slot) {
+		entry *entry = *slot;
+		*slot = entry->next_hash;
+		free(entry);
+		main->overflow.size--;
 	}
 }
 
-void sort_servers(load_balancer* main) {
-	// Sort the servers by hash_ring_position
-	while (true) {
-		bool swapped = false;
-		for (unsigned int i = 0; i < main->servers_count - 1; i++) {
-			if (main->servers[i]->hash_ring_position >
-				main->servers[i + 1]->hash_ring_position) {
-				server *temp = main->servers[i];
-				main->servers[i] = main->servers[i + 1];
-				main->servers[i + 1] = temp;
-				swapped = true;
-			}
+server *loader_find_server(load_balancer* main, unsigned int doc_hash) {
+	return placement_lookup(main->placement, doc_hash);
+}
+
+server *loader_find_home(load_balancer* main, unsigned int doc_hash,
+						 char *doc_name) {
+	if (main->bounded_loads) {
+		entry **slot = overflow_find(&main->overflow, doc_hash, doc_name);
+
+		if (slot) {
+			return (*slot)->value;
 		}
-		if (!swapped) {
-			break;
+	}
+
+	return placement_lookup(main->placement, doc_hash);
+}
+
+/*
+ * Bounded-load placement of a request whose document has no recorded home:
+ * the placement owner keeps it if it is under the load cap or already knows
+ * the document, otherwise it goes to the first following server under the
+ * cap, which is then recorded as the document's home.
+ */
+static server *bounded_find_server(load_balancer* main, request *req) {
+	unsigned int doc_hash = req->doc_hash;
+	server *owner = placement_lookup(main->placement, doc_hash);
+	unsigned long long total_load = 0;
+
+	for (unsigned int i = 0; i < main->servers_count; i++) {
+		total_load += server_load(main->servers[i]);
+	}
+
+	// Capacity ceil((1 + eps) * m / n), counting the incoming request
+	double cap = (1 + main->load_epsilon) * (double)(total_load + 1) /
+				 main->servers_count;
+	unsigned long long bound = (unsigned long long)cap;
+	if (bound < cap) {
+		bound++;
+	}
+
+	// A GET for a document without a recorded home can only find it
+	// on its owner, so it never overflows
+	if (req->type == GET_DOCUMENT || server_load(owner) < bound ||
+		server_has_document(owner, doc_hash, req->doc_name)) {
+		return owner;
+	}
+
+	for (unsigned int i = 1;; i++) {
+		server *candidate = placement_probe(main->placement, doc_hash, i);
+
+		// Everyone is over the cap only if the cap is being rounded away
+		if (!candidate) {
+			return owner;
+		}
+
+		if (candidate != owner && server_load(candidate) < bound) {
+			overflow_put(main, doc_hash, req->doc_name, candidate);
+			return candidate;
 		}
 	}
 }
 
-void migrate_db_on_add(load_balancer* main, server* source_server,
-						server* destination_server) {
-	for (unsigned int i = 0; i < source_server->db->capacity; i++) {
-		if (source_server->db->map[i]) {
-			entry *entry = source_server->db->map[i];
-			unsigned int doc_hash =
-					main->hash_function_docs(
-							source_server->db->map[i]->key);
-			while (entry) {
-				struct entry *next = entry->next_hash;
+response *loader_forward_request(load_balancer* main, request *req) {
+	server *s;
+
+	// Find the server that should handle the request, by the document hash
+	// computed when the request was read
+	if (main->bounded_loads) {
+		entry **slot = overflow_find(&main->overflow, req->doc_hash,
+									 req->doc_name);
+
+		if (slot) {
+			s = (*slot)->value;
+		} else {
+			// The decision reads the load of every server
+			loader_sync_workers(main);
+			s = bounded_find_server(main, req);
+		}
+	} else {
+		s = placement_lookup(main->placement, req->doc_hash);
+	}
 
-				// Find the documents that need to be migrated
-				if (doc_hash < destination_server->hash_ring_position ||
-					doc_hash > source_server->hash_ring_position) {
-					db_put(destination_server->db,
-						   source_server->db->map[i]->key,
-						   source_server->db->map[i]->value);
-
-					db_remove(source_server->db,
-							  doc_hash % source_server->db->capacity,
-							  source_server->db->map[i]->key);
-				}
-				entry = next;
-			}
+	if (s->worker) {
+		worker_pool_submit(main->workers, s, req);
+		return NULL;
+	}
+
+	return server_handle_request(s, req);
+}
+
+void loader_print_response(load_balancer* main, response *resp) {
+	server_write_response(&main->out, resp);
+
+	// Servers and workers append to the same buffer; write it in batches
+	if (main->out.len >= OUTPUT_BATCH_BYTES) {
+		output_flush(&main->out, STDOUT_FILENO);
+	}
+}
+
+void migrate_db_on_add(load_balancer* main, server* source_server) {
+	db_iterator it;
+	entry *entry;
+
+	db_iter_init(&it, source_server->db);
+	while ((entry = db_iter_next(&it))) {
+		server *owner = loader_find_home(main, entry->hash, entry->key);
+
+		// Find the documents that need to be migrated; the entry itself
+		// moves, the cache copies are dropped afterwards
+		if (owner != source_server) {
+			db_adopt(owner->db,
+					 db_take(source_server->db, entry->hash, entry->key));
 		}
 	}
+	db_iter_end(&it);
 }
 
-void migrate_cache_on_add(load_balancer* main, server* source_server,
-						  server* destination_server) {
+void migrate_cache_on_add(load_balancer* main, server* source_server) {
 	// Cache variable
 	lru_cache *cache = source_server->cache;
 
-	for (unsigned int i = 0; i < cache->capacity; i++) {
-		if (cache->map[i]) {
-			entry *entry = cache->map[i];
-			unsigned int doc_hash = main->hash_function_docs(
-					cache->map[i]->key);
-			while (entry) {
-				struct entry *next = entry->next_hash;
+	for (unsigned int i = 0; i < cache->buckets; i++) {
+		entry *entry = cache->map[i];
 
-				// Find the documents that need to be removed
-				if (doc_hash < destination_server->hash_ring_position ||
-					doc_hash > source_server->hash_ring_position) {
-					lru_cache_remove(cache, doc_hash % cache->capacity,
-									 cache->map[i]->key);
-				}
-				entry = next;
+		while (entry) {
+			struct entry *next = entry->next_hash;
+
+			// Find the documents that need to be removed
+			if (loader_find_home(main, entry->hash, entry->key) !=
+				source_server) {
+				lru_cache_remove(cache, entry->hash, entry->key);
 			}
+			entry = next;
 		}
 	}
 }
 
-void migrate_db_on_remove(load_balancer* main, server* source_server,
-						  server* destination_server) {
-	for (unsigned int i = 0; i < source_server->db->capacity; i++) {
-		if (source_server->db->map[i]) {
-			entry *entry = source_server->db->map[i];
-			unsigned int doc_hash =
-					main->hash_function_docs(
-							source_server->db->map[i]->key);
-			while (entry) {
-				struct entry *next = entry->next_hash;
-				// Migrate the documents
-				db_put(destination_server->db,
-					   source_server->db->map[i]->key,
-					   source_server->db->map[i]->value);
-
-				db_remove(source_server->db,
-						  doc_hash % source_server->db->capacity,
-						  source_server->db->map[i]->key);
-				entry = next;
-			}
+void migrate_arc_on_add(load_balancer* main, server* source_server,
+						placement_arc *arc) {
+	db_range_iterator it;
+	entry *entry;
+
+	db_range_init(&it, source_server->db, arc->from, arc->to);
+	while ((entry = db_range_next(&it))) {
+		server *owner = loader_find_home(main, entry->hash, entry->key);
+
+		// Documents recorded elsewhere by bounded loads stay put
+		if (owner != source_server) {
+			lru_cache_remove(source_server->cache, entry->hash, entry->key);
+			db_adopt(owner->db,
+					 db_take(source_server->db, entry->hash, entry->key));
 		}
 	}
+	db_range_end(&it);
 }
 
-void loader_add_server_no_vnodes(load_balancer* main, unsigned int server_id,
-					   unsigned int cache_size) {
-	// Create a new server
-	main->servers[main->servers_count] = init_server(server_id, cache_size);
-	main->servers_count++;
+void migrate_arc_on_remove(load_balancer* main, server* source_server,
+						   placement_arc *arc) {
+	db_range_iterator it;
+	entry *entry;
 
-	// Migrate documents
-	if (main->servers_count == 1) {
-		return;
-	} else {
-		// Server variables
-		server *source_server = NULL;
-		server *destination_server = main->servers[main->servers_count - 1];
-
-		// Find the source server
-		for (unsigned int i = 0; i < main->servers_count; i++) {
-			if (main->servers[i]->hash_ring_position >
-				destination_server->hash_ring_position) {
-				source_server = main->servers[i];
-				break;
-			}
+	db_range_init(&it, source_server->db, arc->from, arc->to);
+	while ((entry = db_range_next(&it))) {
+		if (main->bounded_loads) {
+			overflow_remove(main, entry->hash, entry->key);
 		}
 
-		// If the destination server is the last server in the ring
-		if (!source_server) {
-			source_server = main->servers[0];
-		}
+		// The whole arc goes to the server right after it
+		db_adopt(arc->neighbour->db,
+				 db_take(source_server->db, entry->hash, entry->key));
+	}
+	db_range_end(&it);
+}
 
-		// Execute all requests from the source server request queue
-		server_execute_all_requests(source_server);
+void migrate_db_on_remove(load_balancer* main, server* source_server) {
+	db_iterator it;
+	entry *entry;
 
-		// Migrate documents from the database
-		migrate_db_on_add(main, source_server, destination_server);
+	db_iter_init(&it, source_server->db);
+	while ((entry = db_iter_next(&it))) {
+		// The document leaves its recorded home, if it had one
+		if (main->bounded_loads) {
+			overflow_remove(main, entry->hash, entry->key);
+		}
 
-		// Eliminate the documents from the cache
-		// that are now in the destination server
-		migrate_cache_on_add(main, source_server, destination_server);
+		// Hand the entry over to its new owner as it is
+		db_adopt(loader_find_server(main, entry->hash)->db,
+				 db_take(source_server->db, entry->hash, entry->key));
 	}
-
-	// Sort the servers by hash_ring_position
-	sort_servers(main);
+	db_iter_end(&it);
 }
 
-void loader_add_server_vnodes(load_balancer* main, unsigned int server_id,
-							  unsigned int cache_size) {
-	// Create a new server
-	main->servers[main->servers_count] = init_server(server_id, cache_size);
-
-	// Create two virtual servers
-	server *virtual_server1 = calloc(1, sizeof(server));
-	server *virtual_server2 = calloc(1, sizeof(server));
-
-	// Create the first virtual server
-	virtual_server1->server_id = 1 * 100000 + server_id;
-	virtual_server1->hash_ring_position = main->hash_function_servers(
-			&virtual_server1->server_id);
-	virtual_server1->request_queue =
-			main->servers[main->servers_count]->request_queue;
-	virtual_server1->cache = main->servers[main->servers_count]->cache;
-	virtual_server1->db = main->servers[main->servers_count]->db;
-
-	// Create the second virtual server
-	virtual_server2->server_id = 2 * 100000 + server_id;
-	virtual_server2->hash_ring_position = main->hash_function_servers(
-			&virtual_server2->server_id);
-	virtual_server2->request_queue =
-			main->servers[main->servers_count]->request_queue;
-	virtual_server2->cache = main->servers[main->servers_count]->cache;
-	virtual_server2->db = main->servers[main->servers_count]->db;
-
-	// Add the servers to the load balancer
-	main->servers[main->servers_count + 1] = virtual_server1;
-	main->servers[main->servers_count + 2] = virtual_server2;
-	main->servers_count += 3;
-
-	// Migrate documents
-	if (main->servers_count == 3) {
-		sort_servers(main);
+/* A cached document changing servers, with its place in the old cache */
+typedef struct cache_handoff {
+	entry *entry;           /* Database entry, which moves as it is */
+	server *to;
+	double rank;            /* 0 for the hottest entry of the old cache */
+} cache_handoff;
+
+typedef struct handoff_list {
+	cache_handoff *items;
+	unsigned int count;
+	unsigned int capacity;
+} handoff_list;
+
+/*
+ * Records the cached documents of the source server which are about to
+ * move (all of them if it is leaving). Must run before the migration,
+ * while their database entries are still in the source's database.
+ */
+static void handoff_collect(load_balancer* main, server *source,
+							bool leaving, handoff_list *list) {
+	lru_cache *cache = source->cache;
+
+	if (!main->cache_handoff || cache->size == 0) {
 		return;
-	} else {
-		for (unsigned int i = 0; i < 3; i++) {
-			server *source_server = NULL;
-			server *destination_server = main->servers[main->servers_count - i - 1];
-
-			// Find the source server
-			for (unsigned int j = 0; j < main->servers_count; j++) {
-				if (main->servers[j]->hash_ring_position >
-					destination_server->hash_ring_position) {
-					source_server = main->servers[j];
-					break;
-				}
-			}
+	}
 
-			// If the destination server is the last server in the ring
-			if (!source_server) {
-				source_server = main->servers[0];
-			}
+	entry **ranked = malloc(cache->size * sizeof(entry *));
+	DIE(ranked == NULL, "malloc failed");
 
-			// Execute all requests from the source server request queue
-			server_execute_all_requests(source_server);
+	unsigned int count = lru_cache_rank(cache, ranked);
 
-			// Migrate documents from the database
-			migrate_db_on_add(main, source_server, destination_server);
+	for (unsigned int i = 0; i < count; i++) {
+		entry *cached = ranked[i];
 
-			// Eliminate the documents from the cache
-			// that are now in the destination server
-			migrate_cache_on_add(main, source_server, destination_server);
+		if (!leaving &&
+			loader_find_home(main, cached->hash, cached->key) == source) {
+			continue;
 		}
+
+		entry *stored = db_get_entry(source->db, cached->hash, cached->key);
+		if (!stored) {
+			continue;
+		}
+
+		if (list->count == list->capacity) {
+			list->capacity = list->capacity ? 2 * list->capacity : 64;
+			list->items = realloc(list->items,
+								  list->capacity * sizeof(cache_handoff));
+			DIE(list->items == NULL, "realloc failed");
+		}
+
+		list->items[list->count++] = (cache_handoff) {
+			.entry = stored,
+			.rank = (double)i / count,
+		};
 	}
 
-	sort_servers(main);
+	free(ranked);
 }
 
-void loader_remove_server_no_vnodes(load_balancer* main,
-									unsigned int server_id) {
-	if (main->servers_count == 0) {
-		return;
-	} else if (main->servers_count == 1) {
-		free_server(&main->servers[0]);
-		main->servers_count--;
+static int handoff_compare(const void *a, const void *b) {
+	const cache_handoff *x = a, *y = b;
+
+	if (x->to->server_id != y->to->server_id) {
+		return x->to->server_id < y->to->server_id ? -1 : 1;
+	}
+
+	return (x->rank > y->rank) - (x->rank < y->rank);
+}
+
+/*
+ * Caches the collected documents on the servers now storing them: the
+ * hottest ones up to each cache's capacity, inserted coldest first.
+ */
+static void handoff_apply(load_balancer* main, handoff_list *list) {
+	char evicted_key[DOC_NAME_LENGTH + 1];
+
+	if (list->count == 0) {
 		return;
-	} else {
-		// Determine the source server
-		server *destination_server = NULL;
-		server *source_server = NULL;
-
-		// Find the source server
-		for (unsigned int i = 0; i < main->servers_count; i++) {
-			if (main->servers[i]->server_id == server_id) {
-				source_server = main->servers[i];
-				break;
-			}
-		}
+	}
 
-		// Find the destination server
-		for (unsigned int i = 0; i < main->servers_count; i++) {
-			if (main->servers[i]->hash_ring_position >
-				source_server->hash_ring_position) {
-				destination_server = main->servers[i];
-				break;
-			}
+	for (unsigned int i = 0; i < list->count; i++) {
+		entry *stored = list->items[i].entry;
+
+		list->items[i].to = loader_find_home(main, stored->hash, stored->key);
+	}
+
+	qsort(list->items, list->count, sizeof(cache_handoff), handoff_compare);
+
+	for (unsigned int first = 0; first < list->count;) {
+		server *to = list->items[first].to;
+		unsigned int last = first;
+
+		while (last < list->count && list->items[last].to == to) {
+			last++;
 		}
 
-		// If the source server is the last server in the ring
-		if (!destination_server) {
-			destination_server = main->servers[0];
+		unsigned int taken = last - first < to->cache->capacity ?
+							 last - first : to->cache->capacity;
+
+		for (unsigned int i = first + taken; i > first; i--) {
+			entry *stored = list->items[i - 1].entry;
+
+			lru_cache_put(to->cache, stored->hash, stored->key, stored->doc,
+						  evicted_key);
 		}
 
+		first = last;
+	}
+
+	free(list->items);
+	list->items = NULL;
+	list->count = 0;
+	list->capacity = 0;
+}
+
+/*
+ * Hands over the documents which the new placement assigns elsewhere.
+ * Before distributing them, each server executes the tasks in its queue.
+ */
+static void rebalance_sources(load_balancer* main, server **sources,
+							  unsigned int sources_count,
+							  handoff_list *handoff) {
+	for (unsigned int i = 0; i < sources_count; i++) {
 		// Execute all requests from the source server request queue
-		server_execute_all_requests(source_server);
+		server_execute_all_requests(sources[i]);
+
+		// Note its cached documents which are leaving
+		handoff_collect(main, sources[i], false, handoff);
 
 		// Migrate documents from the database
-		// to the destination server's database
-		migrate_db_on_remove(main, source_server, destination_server);
+		migrate_db_on_add(main, sources[i]);
+
+		// Eliminate the documents from the cache
+		// that are now in other servers
+		migrate_cache_on_add(main, sources[i]);
 	}
+}
 
-	// Sort the servers by hash_ring_position and have the current
-	// server_id be the last
-	for (unsigned int i = 0; i < main->servers_count - 1; i++) {
-		if (main->servers[i]->server_id == server_id) {
-			server *temp = main->servers[i];
-			main->servers[i] = main->servers[i + 1];
-			main->servers[i + 1] = temp;
+/*
+ * Same as rebalance_sources(), for engines mapping hash ranges to servers:
+ * a new server only takes over its own arcs, so only the documents inside
+ * them are looked at.
+ */
+static void rebalance_arcs(load_balancer* main, server *s, server **sources,
+						   unsigned int sources_count,
+						   handoff_list *handoff) {
+	placement_arc *arcs = malloc(main->vnodes_count * s->weight *
+								 sizeof(placement_arc));
+	DIE(arcs == NULL, "malloc failed");
+
+	unsigned int arcs_count = placement_arcs(main->placement, s, arcs);
+
+	for (unsigned int i = 0; i < sources_count; i++) {
+		// Execute all requests from the source server request queue
+		server_execute_all_requests(sources[i]);
+		handoff_collect(main, sources[i], false, handoff);
+
+		for (unsigned int j = 0; j < arcs_count; j++) {
+			if (arcs[j].neighbour == sources[i]) {
+				migrate_arc_on_add(main, sources[i], &arcs[j]);
+			}
 		}
 	}
 
-	// Free the server's memory
-	free_server(&main->servers[main->servers_count - 1]);
+	free(arcs);
+}
+
+void loader_add_server(load_balancer* main, unsigned int server_id,
+					   unsigned int cache_size, unsigned long cache_bytes,
+					   unsigned int weight, cache_policy_type cache_policy) {
+	DIE(weight == 0 || weight > MAX_SERVER_WEIGHT, "invalid server weight");
+
+	// Migrations touch several servers at once
+	loader_sync_workers(main);
+
+	// Create a new server
+	server *s = init_server(server_id, cache_size, cache_bytes, cache_policy,
+							main->db_engine);
+	s->weight = weight;
+	s->lazy_gets = main->lazy_gets;
+	s->out = &main->out;
+
+	if (main->cache_admission) {
+		lru_cache_enable_admission(s->cache);
+	}
+
+	if (main->servers_count == main->servers_capacity) {
+		main->servers_capacity = main->servers_capacity ?
+								 2 * main->servers_capacity : 16;
+		main->servers = realloc(main->servers,
+								main->servers_capacity * sizeof(server *));
+		DIE(main->servers == NULL, "realloc failed");
+	}
+	main->servers[main->servers_count++] = s;
+
+	// Place it and collect the servers which may lose documents to it
+	server **sources = malloc(main->servers_count * sizeof(server *));
+	DIE(sources == NULL, "malloc failed");
+
+	unsigned int sources_count = placement_add_server(main->placement, s,
+													  sources);
+
+	handoff_list handoff = { 0 };
 
-	main->servers[main->servers_count - 1] = NULL;
+	if (placement_has_arcs(main->placement)) {
+		rebalance_arcs(main, s, sources, sources_count, &handoff);
+	} else {
+		rebalance_sources(main, sources, sources_count, &handoff);
+	}
 
-	main->servers_count--;
+	// Warm up the new server with the hot documents it got
+	handoff_apply(main, &handoff);
+
+	// From now on only its own thread touches the server
+	if (main->workers) {
+		worker_start(s);
+	}
+
+	free(sources);
 }
 
-void loader_remove_server_vnodes(load_balancer* main, unsigned int server_id) {
-	if (main->servers_count == 0) {
-		return;
-	} else if (main->servers_count == 3) {
-		free_server(&main->servers[0]);
-		free_virtual_server(&main->servers[1]);
-		free_virtual_server(&main->servers[2]);
-		main->servers_count -= 3;
+void loader_remove_server(load_balancer* main, unsigned int server_id) {
+	server *s = NULL;
+
+	// Find the server and drop it from the server list
+	for (unsigned int i = 0; i < main->servers_count; i++) {
+		if (main->servers[i]->server_id == server_id) {
+			s = main->servers[i];
+			memmove(&main->servers[i], &main->servers[i + 1],
+					(main->servers_count - i - 1) * sizeof(server *));
+			main->servers_count--;
+			break;
+		}
+	}
+
+	if (!s) {
 		return;
-	} else {
-		unsigned int id;
-		for (unsigned int k = 0; k < 3; k++) {
-			server *destination_server = NULL;
-			server *source_server = NULL;
-			for (unsigned int i = 0; i < main->servers_count - k; i++) {
-				if (1 * 100000 + server_id == main->servers[i]->server_id ||
-					2 * 100000 + server_id == main->servers[i]->server_id ||
-					server_id == main->servers[i]->server_id) {
-					id = main->servers[i]->server_id;
-					source_server = main->servers[i];
-					break;
-				}
-			}
+	}
 
-			for (unsigned int j = 0; j < main->servers_count - k; j++) {
-				if (main->servers[j]->hash_ring_position >
-					source_server->hash_ring_position) {
-					if (main->servers[j]->server_id != server_id &&
-						main->servers[j]->server_id != 1 * 100000 + server_id &&
-						main->servers[j]->server_id != 2 * 100000 + server_id) {
-						destination_server = main->servers[j];
-						break;
-					}
-				}
-			}
+	// Migrations touch several servers at once
+	loader_sync_workers(main);
+	if (s->worker) {
+		worker_stop(s);
+	}
 
-			if (!destination_server) {
-				destination_server = main->servers[0];
-			}
+	// Note who takes over each of its arcs while it is still placed
+	placement_arc *arcs = NULL;
+	unsigned int arcs_count = 0;
+
+	if (placement_has_arcs(main->placement)) {
+		arcs = malloc(main->vnodes_count * s->weight * sizeof(placement_arc));
+		DIE(arcs == NULL, "malloc failed");
 
-			// Execute all requests from the source server request queue
-			server_execute_all_requests(source_server);
+		arcs_count = placement_arcs(main->placement, s, arcs);
+	}
 
-			// Migrate documents from the database
-			// to the destination server's database
-			migrate_db_on_remove(main, source_server, destination_server);
+	// Take it out of the placement
+	server **sources = malloc((main->servers_count + 1) * sizeof(server *));
+	DIE(sources == NULL, "malloc failed");
 
-			for (unsigned int j = 0; j < main->servers_count - 1 - k; j++) {
-				if (id == main->servers[j]->server_id) {
-					server *temp = main->servers[j];
-					main->servers[j] = main->servers[j + 1];
-					main->servers[j + 1] = temp;
-				}
-			}
+	unsigned int sources_count = placement_remove_server(main->placement, s,
+														 sources);
+
+	// Execute all requests from the source server request queue; queued
+	// EDITs still print their responses, even if it was the last server
+	server_execute_all_requests(s);
+
+	if (main->servers_count > 0) {
+		// Its cache goes away; the moved values must not stay shared
+		handoff_list handoff = { 0 };
+
+		handoff_collect(main, s, true, &handoff);
+		lru_cache_clear(s->cache);
+
+		// Move each arc straight to its new owner, without any lookup
+		for (unsigned int i = 0; i < arcs_count; i++) {
+			migrate_arc_on_remove(main, s, &arcs[i]);
+		}
+
+		// Whatever is left (e.g. placed here by bounded loads from other
+		// arcs, or every document without arcs) is looked up one by one
+		if (s->db->size > 0) {
+			migrate_db_on_remove(main, s);
 		}
+
+		// Other servers may lose documents too, depending on the placement
+		rebalance_sources(main, sources, sources_count, &handoff);
+
+		// Its hot documents stay cached on their new servers
+		handoff_apply(main, &handoff);
+
+		// The moved entries still live in the server's slab chunks
+		slab_merge(main->servers[0]->slab, s->slab);
 	}
 
+	free(sources);
+	free(arcs);
+
 	// Free the server's memory
-	free_server(&main->servers[main->servers_count - 1]);
-	free_virtual_server(&main->servers[main->servers_count - 2]);
-	free_virtual_server(&main->servers[main->servers_count - 3]);
+	free_server(&s);
+}
 
-	main->servers[main->servers_count - 1] = NULL;
-	main->servers[main->servers_count - 2] = NULL;
-	main->servers[main->servers_count - 3] = NULL;
+void loader_memory_report(load_balancer* main, FILE *out) {
+	unsigned long total_db = 0, total_cache = 0, total_docs = 0;
+	slab_stats total_stats = {0};
+
+	loader_sync_workers(main);
+
+	for (unsigned int i = 0; i < main->servers_count; i++) {
+		server *s = main->servers[i];
+		unsigned long db_bytes, cache_bytes;
+
+		server_memory_usage(s, &db_bytes, &cache_bytes);
+		fprintf(out, "[Server %u] documents: %u (%lu bytes), "
+				"cached: %u (%lu bytes)", s->server_id, s->db->size,
+				db_bytes, s->cache->size, cache_bytes);
+		if (s->cache->limit_bytes) {
+			fprintf(out, ", cache budget: %lu/%lu bytes",
+					s->cache->used_bytes, s->cache->limit_bytes);
+		}
+		fprintf(out, "\n");
+
+		total_db += db_bytes;
+		total_cache += cache_bytes;
+		total_docs += s->db->size;
+
+		total_stats.allocs += s->slab->stats.allocs;
+		total_stats.frees += s->slab->stats.frees;
+		total_stats.chunk_mallocs += s->slab->stats.chunk_mallocs;
+		total_stats.large_mallocs += s->slab->stats.large_mallocs;
+		total_stats.chunk_bytes += s->slab->stats.chunk_bytes;
+	}
 
-	main->servers_count -= 3;
+	fprintf(out, "Total: %lu documents, %lu bytes in databases, "
+			"%lu bytes in caches, %.1f bytes per document\n", total_docs,
+			total_db, total_cache,
+			total_docs ? (double)(total_db + total_cache) / total_docs : 0.0);
+	fprintf(out, "Slab: %lu allocations, %lu frees, %lu malloc calls "
+			"(%lu chunks, %lu bytes; %lu oversized objects)\n",
+			total_stats.allocs, total_stats.frees,
+			total_stats.chunk_mallocs + total_stats.large_mallocs,
+			total_stats.chunk_mallocs, total_stats.chunk_bytes,
+			total_stats.large_mallocs);
 }
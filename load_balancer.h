@@ -6,35 +6,164 @@
 #define LOAD_BALANCER_H
 
 #include "server.h"
+#include "placement.h"
+#include "worker.h"
 
-#define MAX_SERVERS             99999
+#define DEFAULT_VNODES_COUNT    3
+#define MAX_VNODES_COUNT        1024
+#define MAX_SERVER_WEIGHT       64
+
+#define DEFAULT_LOAD_EPSILON    0.25
+
+/*
+ * Documents which bounded loads placed away from their placement owner,
+ * mapped to the server actually storing them.
+ */
+typedef struct overflow_table {
+	entry **map;
+	unsigned int size;
+	unsigned int capacity;
+} overflow_table;
 
 typedef struct load_balancer {
     unsigned int (*hash_function_servers)(void *);
     unsigned int (*hash_function_docs)(void *);
-    server *servers[MAX_SERVERS];
+
+    /* Physical servers, in the order they were added */
+    server **servers;
 	unsigned int servers_count;
+	unsigned int servers_capacity;
+
+    /* Maps document hashes to servers */
+    placement *placement;
+
 	bool enable_vnodes;
+	unsigned int vnodes_count;
+
+    /* Consistent hashing with bounded loads */
+	bool bounded_loads;
+	double load_epsilon;
+	overflow_table overflow;
+
+    /* Table used by the databases of new servers */
+	db_engine db_engine;
+
+    /* Whether the caches of new servers get an admission gate */
+	bool cache_admission;
+
+    /* Whether new servers answer GETs without executing their queue */
+	bool lazy_gets;
+
+    /* Whether cached documents keep being cached when they migrate */
+	bool cache_handoff;
+
+    /* Orders the output of the server threads; NULL when the requests
+     * run on the caller's thread */
+	worker_pool *workers;
+
+    /* Responses waiting to be written to stdout */
+	output_buffer out;
 } load_balancer;
 
-load_balancer *init_load_balancer(bool enable_vnodes);
+/**
+ * init_load_balancer() - Creates an empty load balancer.
+ *
+ * @param enable_vnodes: Whether servers get replica points on the ring.
+ * @param vnodes_count: Ring points per unit of weight when vnodes are
+ *        enabled (0 selects DEFAULT_VNODES_COUNT).
+ * @param placement_type: Algorithm which maps documents to servers.
+ */
+load_balancer *init_load_balancer(bool enable_vnodes,
+								  unsigned int vnodes_count,
+								  placement_type placement_type);
 
 void free_load_balancer(load_balancer** main);
 
+/**
+ * loader_enable_bounded_loads() - Caps the load of every server at
+ *      (1 + epsilon) times the average load.
+ *
+ * @brief A new document whose owner is over the cap is placed on the next
+ *      ring point whose server is under it. The load balancer remembers
+ *      where such documents went, so later requests for them (and
+ *      migrations) keep finding them even when loads change. Only
+ *      available with the ring placement.
+ */
+void loader_enable_bounded_loads(load_balancer* main, double epsilon);
+
+/**
+ * loader_set_db_engine() - Selects the table used by the databases of the
+ *      servers added from now on.
+ */
+void loader_set_db_engine(load_balancer* main, db_engine db_engine);
+
+/**
+ * loader_enable_cache_admission() - Gives the caches of the servers added
+ *      from now on an admission gate, so that keys accessed only once do
+ *      not evict the working set.
+ */
+void loader_enable_cache_admission(load_balancer* main);
+
+/**
+ * loader_enable_lazy_gets() - Lets the servers added from now on answer a
+ *      GET without executing the EDITs queued before it.
+ *
+ * @brief The GET returns the content of the latest queued EDIT of the
+ *      document, or else the one in the cache or database, which no queued
+ *      request touches. The queued EDITs still run in order (and print
+ *      their responses) when the queue fills up, before a migration, or
+ *      when the load balancer is freed.
+ */
+void loader_enable_lazy_gets(load_balancer* main);
+
+/**
+ * loader_enable_cache_handoff() - Lets cached documents stay cached when
+ *      adding or removing a server moves them.
+ *
+ * @brief The moved documents which were cached by their old server are
+ *      put in the cache of the new one, coldest first, so the ones the old
+ *      cache valued most end up as the most recently used. A server takes
+ *      at most as many of them as its cache capacity; its replacement
+ *      policy (and admission gate) decides what makes room for them.
+ */
+void loader_enable_cache_handoff(load_balancer* main);
+
+/**
+ * loader_enable_workers() - Gives every server, present or added later, a
+ *      thread of its own which handles the requests forwarded to it.
+ *
+ * @brief loader_forward_request() then only queues the request and returns
+ *      NULL; the responses are printed to stdout in the order the requests
+ *      were forwarded, as soon as they (and all the earlier ones) are
+ *      ready. Adding or removing a server, the memory report and bounded
+ *      load decisions first wait for every forwarded request.
+ *
+ *      Off unless asked for. Every request pays for a task copy, a ring slot
+ *      and the sequencer, which costs as much as the server's own work for
+ *      small documents; it only pays off with free cores and servers doing
+ *      far more per request than that (bench_workers: 0.6-0.84x on 1 CPU).
+ */
+void loader_enable_workers(load_balancer* main);
+
 /**
  * loader_add_server() - Adds a new server to the system.
  * 
  * @param main: Load balancer which distributes the work.
  * @param server_id: ID of the new server.
- * @param cache_size: Capacity of the new server's cache.
+ * @param cache_size: Capacity of the new server's cache, in entries.
+ * @param cache_bytes: Byte budget of the cache instead, if not 0.
+ * @param weight: Relative capacity of the server; it gets
+ *        weight * vnodes_count points on the ring.
+ * @param cache_policy: Replacement policy of the new server's cache.
  * 
- * @brief The load balancer will generate 1 or 3 replica labels and will place
+ * @brief The load balancer will generate the replica labels and will place
  * them inside the hash ring. The neighbor servers will distribute SOME of the
  * documents to the added server. Before distributing the documents, these
  * servers should execute all the tasks in their queues.
  */
 void loader_add_server(load_balancer* main, unsigned int server_id,
-					   unsigned int cache_size);
+					   unsigned int cache_size, unsigned long cache_bytes,
+					   unsigned int weight, cache_policy_type cache_policy);
 
 /**
  * loader_remove_server() Removes a server from the system.
@@ -55,74 +184,79 @@ void loader_remove_server(load_balancer* main, unsigned int server_id);
  * loader_forward_request() - Forwards a request to the appropriate server.
  * 
  * @param main: Load balancer which distributes the work.
- * @param req: Request to be forwarded (relevant fields from the request are
- *        dynamically allocated, but the caller have to free them).
+ * @param req: Request to be forwarded. Its name and content are only
+ *        borrowed: the server copies whatever it keeps.
  * 
- * @return response* - Contains the response received from the server
+ * @return response* - Contains the response received from the server, or
+ *         NULL if the request was handed to the server's thread. It has
+ *         to be printed with loader_print_response() before the next
+ *         request is forwarded.
  * 
  * @brief The load balancer will find the server which should handle the
- * request and will send the request to that server. The request will contain
- * the document name and/or content, which are dynamically allocated in main
- * and should be freed either here, either in server_handle_request, after
- * using them.
+ * request and will send the request to that server.
  */
 response *loader_forward_request(load_balancer* main, request *req);
 
 /**
- * sort_servers() - Sorts the servers in the load balancer
- * 		by their hash ring position.
+ * loader_print_response() - Appends a response (if not NULL) to the output,
+ *      which is written to stdout once OUTPUT_BATCH_BYTES have piled up and
+ *      when the load balancer is freed.
  */
-void sort_servers(load_balancer* main);
+void loader_print_response(load_balancer* main, response *resp);
 
 /**
- * migrate_db_on_add() - Migrates the documents from the source server's
- * 		database to the destination server's database.
+ * loader_find_server() - Returns the server owning a document hash.
  */
-void migrate_db_on_add(load_balancer* main, server* source_server,
-					   server* destination_server);
+server *loader_find_server(load_balancer* main, unsigned int doc_hash);
 
 /**
- * migrate_cache_on_add() - Migrates the documents from the source server's
- * 		cache to the destination server's cache.
+ * loader_find_home() - Returns the server which should store a document:
+ *      the one recorded for it by bounded loads, if any, otherwise its
+ *      placement owner.
  */
-void migrate_cache_on_add(load_balancer* main, server* source_server,
-						  server* destination_server);
-
+server *loader_find_home(load_balancer* main, unsigned int doc_hash,
+						 char *doc_name);
 
 /**
- * migrate_db_on_remove() - Migrates the documents from the source server's
- * 		database to the destination server's database.
+ * loader_memory_report() - Prints the memory held by every server's
+ *      database and cache, as computed by server_memory_usage().
  */
-void migrate_db_on_remove(load_balancer* main, server* source_server,
-						  server* destination_server);
-
+void loader_memory_report(load_balancer* main, FILE *out);
 
 /**
- * loader_add_server_no_vnodes() - Adds a server to the load balancer
- * 		(no virtual nodes).
+ * migrate_db_on_add() - Migrates the documents of the source server's
+ * 		database which the placement now assigns to other servers.
  */
-void loader_add_server_no_vnodes(load_balancer* main, unsigned int server_id,
-								 unsigned int cache_size);
+void migrate_db_on_add(load_balancer* main, server* source_server);
 
 /**
- * loader_add_server_vnodes() - Adds a server to the load balancer
- * 		(with virtual nodes).
+ * migrate_cache_on_add() - Removes from the source server's cache the
+ * 		documents which now belong to other servers.
  */
-void loader_add_server_vnodes(load_balancer* main, unsigned int server_id,
-							  unsigned int cache_size);
+void migrate_cache_on_add(load_balancer* main, server* source_server);
 
 /**
- * loader_remove_server_no_vnodes() - Removes a server from the load balancer
- * 		(no virtual nodes).
+ * migrate_arc_on_add() - Migrates the documents of the source server whose
+ * 		hashes lie in the arc and which now belong to other servers,
+ * 		dropping them from its cache as well. Only the documents inside the
+ * 		arc are looked at.
  */
-void loader_remove_server_no_vnodes(load_balancer* main,
-									unsigned int server_id);
+void migrate_arc_on_add(load_balancer* main, server* source_server,
+						placement_arc *arc);
 
 /**
- * loader_remove_server_vnodes() - Removes a server from the load balancer
- * 		(with virtual nodes).
+ * migrate_arc_on_remove() - Migrates the documents of the source server
+ * 		whose hashes lie in the arc to the server taking the arc over, as
+ * 		returned by placement_arcs() before the source was removed.
  */
-void loader_remove_server_vnodes(load_balancer* main, unsigned int server_id);
+void migrate_arc_on_remove(load_balancer* main, server* source_server,
+						   placement_arc *arc);
 
+/**
+ * migrate_db_on_remove() - Migrates every document of the source server's
+ * 		database to its new owner. The source server must already be
+ * 		removed from the placement.
+ */
+void migrate_db_on_remove(load_balancer* main, server* source_server);
 
 #endif /* LOAD_BALANCER_H */
@@ -2,234 +2,343 @@
  * Copyright (c) 2024, Negru Alexandru
  */
 
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include "lru_cache.h"
 #include "utils.h"
 
-lru_cache *init_lru_cache(unsigned int cache_capacity) {
+lru_cache *init_lru_cache(unsigned int cache_capacity,
+						  unsigned long cache_bytes, slab_allocator *slab,
+						  cache_policy_type policy_type) {
 	lru_cache *cache = calloc(1, sizeof(lru_cache));
 	DIE(cache == NULL, "calloc failed");
 
+	if (cache_bytes) {
+		unsigned long entries = cache_bytes /
+				(slab_object_size(sizeof(entry)) + CACHE_AVG_VALUE_BYTES);
+
+		cache_capacity = entries ? entries : 1;
+	}
+
+	cache->slab = slab;
 	cache->capacity = cache_capacity;
 	cache->size = 0;
-	cache->head = NULL;
-	cache->tail = NULL;
-	cache->map = calloc(cache_capacity, sizeof(entry *));
+	cache->limit_bytes = cache_bytes;
+	cache->used_bytes = 0;
+
+	// The map grows with the entries if they are limited by bytes
+	cache->buckets = cache_bytes ? CACHE_MIN_BUCKETS : cache_capacity;
+	cache->map = calloc(cache->buckets, sizeof(entry *));
 	DIE(cache->map == NULL, "calloc failed");
 
+	cache->policy_type = policy_type;
+	cache->policy = &cache_policies[policy_type];
+	cache->policy->init(cache);
+
 	return cache;
 }
 
-bool lru_cache_is_full(lru_cache *cache) {
-	return cache->size == cache->capacity;
+static size_t doc_value_size(unsigned int value_len) {
+	return sizeof(doc_value) + value_len + 1;
 }
 
-void free_lru_cache(lru_cache **cache) {
-	entry *current = (*cache)->head;
-	entry *next = NULL;
+doc_value *doc_value_create(slab_allocator *slab, void *value,
+							unsigned int value_len) {
+	doc_value *doc = slab_alloc(slab, doc_value_size(value_len));
+
+	doc->refs = 1;
+	doc->len = value_len;
+	memcpy(doc->data, value, value_len);
+	doc->data[value_len] = '\0';
 
-	while (current) {
-		next = current->next;
-		free(current->key);
-		free(current->value);
-		free(current);
-		current = next;
+	return doc;
+}
+
+void doc_value_release(slab_allocator *slab, doc_value *doc) {
+	if (--doc->refs == 0) {
+		slab_free(slab, doc, doc_value_size(doc->len));
 	}
+}
 
-	free((*cache)->map);
-	free(*cache);
-	*cache = NULL;
+unsigned long doc_value_alloc_size(doc_value *doc) {
+	return slab_object_size(doc_value_size(doc->len));
 }
 
-void *evict_lru_entry(lru_cache *cache) {
-	// Evict the LRU entry
-	entry *current = cache->head;
+entry *entry_create(slab_allocator *slab, unsigned int hash, void *key,
+					doc_value *doc) {
+	entry *entry = slab_alloc(slab, sizeof(struct entry));
+
+	memset(entry, 0, offsetof(struct entry, key));
+	entry->hash = hash;
+	strncpy(entry->key, key, DOC_NAME_LENGTH);
+	entry->key[DOC_NAME_LENGTH] = '\0';
+	entry_share_value(slab, entry, doc);
+
+	return entry;
+}
 
-	void *evicted_key = current->key;
+void entry_destroy(slab_allocator *slab, entry *entry) {
+	entry_drop_value(slab, entry);
+	slab_free(slab, entry, sizeof(struct entry));
+}
 
-	// Update the list
-	if (current->next) {
-		current->next->prev = NULL;
+void entry_set_value(slab_allocator *slab, entry *entry, void *value,
+					 unsigned int value_len) {
+	doc_value *doc = entry->doc;
+
+	// Nobody else sees the buffer: rewrite it if the size class allows
+	if (doc && doc->refs == 1 && slab_object_size(doc_value_size(doc->len)) ==
+								 slab_object_size(doc_value_size(value_len))) {
+		memcpy(doc->data, value, value_len);
+		doc->data[value_len] = '\0';
+		doc->len = value_len;
+		return;
 	}
 
-	if (current->prev) {
-		current->prev->next = current->next;
+	entry_drop_value(slab, entry);
+	entry->doc = doc_value_create(slab, value, value_len);
+}
+
+void entry_share_value(slab_allocator *slab, entry *entry, doc_value *doc) {
+	if (entry->doc == doc) {
+		return;
 	}
 
-	if (cache->tail == current) {
-		cache->tail = current->prev;
+	doc->refs++;
+	entry_drop_value(slab, entry);
+	entry->doc = doc;
+}
+
+void entry_drop_value(slab_allocator *slab, entry *entry) {
+	if (entry->doc) {
+		doc_value_release(slab, entry->doc);
+		entry->doc = NULL;
 	}
+}
 
-	cache->head = current->next;
+unsigned long entry_alloc_size(entry *entry) {
+	unsigned long size = slab_object_size(sizeof(struct entry));
 
-	// Update the map
-	if (current->next_hash) {
-		current->next_hash->prev_hash = current->prev_hash;
+	if (entry->doc->refs == 1) {
+		size += doc_value_alloc_size(entry->doc);
 	}
 
-	if (current->prev_hash) {
-		current->prev_hash->next_hash = current->next_hash;
+	return size;
+}
+
+unsigned long lru_cache_entry_cost(entry *entry) {
+	return slab_object_size(sizeof(struct entry)) +
+		   doc_value_alloc_size(entry->doc);
+}
+
+bool lru_cache_is_full(lru_cache *cache) {
+	if (cache->limit_bytes) {
+		return cache->used_bytes >= cache->limit_bytes;
 	}
 
-	unsigned int hash2 = hash_string(current->key) % cache->capacity;
+	return cache->size == cache->capacity;
+}
+
+void lru_cache_drop_value(lru_cache *cache, entry *entry) {
+	cache->used_bytes -= doc_value_alloc_size(entry->doc);
+	entry_drop_value(cache->slab, entry);
+}
 
-	if (cache->map[hash2] == current) {
-		cache->map[hash2] = current->next_hash;
+void lru_cache_set_value(lru_cache *cache, entry *entry, doc_value *doc) {
+	if (entry->doc) {
+		cache->used_bytes -= doc_value_alloc_size(entry->doc);
 	}
 
-	free(current->value);
-	free(current);
+	entry_share_value(cache->slab, entry, doc);
+	cache->used_bytes += doc_value_alloc_size(doc);
+}
 
-	cache->size--;
-	return evicted_key;
+void lru_cache_enable_admission(lru_cache *cache) {
+	if (!cache->admission) {
+		cache->admission = init_cache_admission(cache->capacity);
+	}
 }
 
-bool lru_cache_put(lru_cache *cache, void *key, void *value,
-                   void **evicted_key) {
-	unsigned int hash = hash_string(key) % cache->capacity;
+void free_lru_cache(lru_cache **cache) {
+	// The entries are released together with the slab they live in
+	if ((*cache)->admission) {
+		free_cache_admission(&(*cache)->admission);
+	}
+	(*cache)->policy->free(*cache);
+	free((*cache)->map);
+	free(*cache);
+	*cache = NULL;
+}
 
-	if (lru_cache_is_full(cache)) {
-		*evicted_key = evict_lru_entry(cache);
+/* Unlinks an entry from the map and frees it */
+static void cache_unlink_entry(lru_cache *cache, entry *entry) {
+	if (entry->next_hash) {
+		entry->next_hash->prev_hash = entry->prev_hash;
+	}
+
+	if (entry->prev_hash) {
+		entry->prev_hash->next_hash = entry->next_hash;
 	} else {
-		*evicted_key = NULL;
+		cache->map[entry->hash % cache->buckets] = entry->next_hash;
 	}
 
-	// Determine the position in the cache
-	struct entry *entry = cache->map[hash];
-	struct entry *prev_hash = NULL;
+	cache->used_bytes -= lru_cache_entry_cost(entry);
+	entry_destroy(cache->slab, entry);
+	cache->size--;
+}
 
-	// Check if the key already exists in the cache
-	while (entry) {
-		if (strcmp((char *)entry->key, (char *)key) == 0) {
-			return false;
+static void cache_link_entry(lru_cache *cache, entry *entry) {
+	unsigned int bucket = entry->hash % cache->buckets;
+
+	entry->prev_hash = NULL;
+	entry->next_hash = cache->map[bucket];
+	if (entry->next_hash) {
+		entry->next_hash->prev_hash = entry;
+	}
+	cache->map[bucket] = entry;
+}
+
+/* Doubles the buckets of a byte-limited cache once it has more entries */
+static void cache_grow_map(lru_cache *cache) {
+	entry **old_map = cache->map;
+	unsigned int old_buckets = cache->buckets;
+
+	cache->buckets *= 2;
+	cache->map = calloc(cache->buckets, sizeof(entry *));
+	DIE(cache->map == NULL, "calloc failed");
+
+	for (unsigned int i = 0; i < old_buckets; i++) {
+		entry *entry = old_map[i];
+
+		while (entry) {
+			struct entry *next = entry->next_hash;
+
+			cache_link_entry(cache, entry);
+			entry = next;
 		}
-		prev_hash = entry;
+	}
+
+	free(old_map);
+}
+
+static entry *cache_find(lru_cache *cache, unsigned int hash, void *key) {
+	entry *entry = cache->map[hash % cache->buckets];
+
+	while (entry && !entry_matches(entry, hash, key)) {
 		entry = entry->next_hash;
 	}
 
-	// Create a new entry
-	entry = calloc(1, sizeof(struct entry));
-	DIE(entry == NULL, "calloc failed");
+	return entry;
+}
+
+/* Whether an entry costing `cost` bytes can only be added after an eviction */
+static bool cache_needs_room(lru_cache *cache, unsigned long cost) {
+	if (cache->size == 0) {
+		return false;
+	}
 
-	entry->key = calloc(DOC_NAME_LENGTH, sizeof(char));
-	DIE(entry->key == NULL, "calloc failed");
-	memcpy(entry->key, key, DOC_NAME_LENGTH);
+	if (cache->limit_bytes) {
+		return cache->used_bytes + cost > cache->limit_bytes;
+	}
 
-	entry->value = calloc(DOC_CONTENT_LENGTH, sizeof(char));
-	DIE(entry->value == NULL, "calloc failed");
-	memcpy(entry->value, value, DOC_CONTENT_LENGTH);
+	return lru_cache_is_full(cache);
+}
 
-	entry->next = NULL;
-	entry->prev = NULL;
+bool lru_cache_put(lru_cache *cache, unsigned int hash, void *key,
+				   doc_value *doc, char *evicted_key) {
+	unsigned long cost = slab_object_size(sizeof(entry)) +
+						 doc_value_alloc_size(doc);
 
-	entry->next_hash = NULL;
-	entry->prev_hash = prev_hash;
+	evicted_key[0] = '\0';
 
-	// Update the map
-	if (prev_hash) {
-		prev_hash->next_hash = entry;
-	} else {
-		cache->map[hash] = entry;
+	// Check if the key already exists in the cache
+	if (cache_find(cache, hash, key)) {
+		return false;
 	}
 
-	// Update the list
-	if (cache->tail) {
-		cache->tail->next = entry;
-		entry->prev = cache->tail;
-	} else {
-		cache->head = entry;
+	if (cache->limit_bytes && cost > cache->limit_bytes) {
+		return false;
 	}
 
-	cache->tail = entry;
+	// Only keys likely to be reused may push others out
+	if (cache->admission) {
+		admission_record(cache->admission, hash);
 
-	cache->size++;
+		if (cache_needs_room(cache, cost) &&
+			!admission_allows(cache->admission, hash)) {
+			return false;
+		}
+	}
 
-	return true;
-}
+	if (cache->policy->miss) {
+		cache->policy->miss(cache, hash);
+	}
 
-void *lru_cache_get(lru_cache *cache, void *key) {
-	unsigned int hash = hash_string(key) % cache->capacity;
-	entry *entry = cache->map[hash];
+	// Evict the entries chosen by the policy until the new one fits
+	while (cache_needs_room(cache, cost)) {
+		entry *victim = cache->policy->evict(cache);
 
-	while (entry) {
-		if (strcmp((char *)entry->key, (char *)key) == 0) {
-			// Update the list
-			if (entry != cache->tail) {
-				if (entry->next) {
-					entry->next->prev = entry->prev;
-				}
+		if (!evicted_key[0]) {
+			strcpy(evicted_key, victim->key);
+		}
+		cache_unlink_entry(cache, victim);
+	}
 
-				if (entry->prev) {
-					entry->prev->next = entry->next;
-				}
+	if (cache->size >= cache->buckets) {
+		cache_grow_map(cache);
+	}
 
-				if (cache->head == entry) {
-					cache->head = entry->next;
-				}
+	// Create a new entry at the head of its bucket
+	entry *entry = entry_create(cache->slab, hash, key, doc);
 
-				entry->prev = cache->tail;
-				entry->next = NULL;
+	cache_link_entry(cache, entry);
+	cache->policy->insert(cache, entry);
+	cache->used_bytes += cost;
+	cache->size++;
 
-				if (cache->tail) {
-					cache->tail->next = entry;
-				} else {
-					cache->head = entry;
-				}
+	return true;
+}
 
-				cache->tail = entry;
-			}
+void *lru_cache_get(lru_cache *cache, unsigned int hash, void *key) {
+	entry *entry = lru_cache_get_entry(cache, hash, key);
 
-			return entry->value;
+	return entry ? entry->doc->data : NULL;
+}
+
+entry *lru_cache_get_entry(lru_cache *cache, unsigned int hash, void *key) {
+	entry *entry = cache_find(cache, hash, key);
+
+	if (entry) {
+		if (cache->admission) {
+			admission_record(cache->admission, entry->hash);
 		}
-		entry = entry->next_hash;
+		cache->policy->hit(cache, entry);
 	}
 
-	return NULL;
+	return entry;
 }
 
 void lru_cache_remove(lru_cache *cache, unsigned int hash, void *key) {
-	entry *entry = cache->map[hash];
-	struct entry *prev = NULL;
-
-	while (entry) {
-		if (strcmp((char *)entry->key, (char *)key) == 0) {
-			// Update the map
-			if (prev) {
-				prev->next_hash = entry->next_hash;
-			} else {
-				cache->map[hash] = entry->next_hash;
-			}
-
-			if (entry->next_hash) {
-				entry->next_hash->prev_hash = prev;
-			}
-
-			// Update the list
-			if (entry->next) {
-				entry->next->prev = entry->prev;
-			}
-
-			if (entry->prev) {
-				entry->prev->next = entry->next;
-			}
-
-			if (cache->head == entry) {
-				cache->head = entry->next;
-			}
-
-			if (cache->tail == entry) {
-				cache->tail = entry->prev;
-			}
-
-			cache->size--;
-
-			free(entry->key);
-			free(entry->value);
-			free(entry);
-			return;
+	entry *entry = cache_find(cache, hash, key);
+
+	if (entry) {
+		cache->policy->remove(cache, entry);
+		cache_unlink_entry(cache, entry);
+	}
+}
+
+void lru_cache_clear(lru_cache *cache) {
+	for (unsigned int i = 0; i < cache->buckets && cache->size > 0; i++) {
+		while (cache->map[i]) {
+			entry *entry = cache->map[i];
+
+			cache->policy->remove(cache, entry);
+			cache_unlink_entry(cache, entry);
 		}
-		prev = entry;
-		entry = entry->next_hash;
 	}
 }
+
+unsigned int lru_cache_rank(lru_cache *cache, entry **entries) {
+	return cache->policy->rank(cache, entries);
+}
@@ -6,62 +6,253 @@
 #define LRU_CACHE_H
 
 #include <stdbool.h>
+#include <string.h>
+
+#include "constants.h"
+#include "slab.h"
+#include "cache_policy.h"
+#include "cache_admission.h"
+
+#define CACHE_MIN_BUCKETS       16
+
+/* Value size assumed when turning a byte budget into a number of entries */
+#define CACHE_AVG_VALUE_BYTES   (DOC_CONTENT_LENGTH / 8)
+
+/*
+ * Contents of a document. The database entry of a document and its cache
+ * entry on the same server point to the same buffer, which is freed when
+ * the last of them lets go of it.
+ */
+typedef struct doc_value {
+	unsigned int refs;
+	unsigned int len;
+	char data[];                /* len bytes and a terminating NUL */
+} doc_value;
 
 typedef struct entry {
-	void *key;
-	void *value;
-	struct entry *next;
-	struct entry *prev;
+	union {
+		doc_value *doc;         /* Database and cache entries */
+		void *value;            /* Other tables (e.g. the overflow table) */
+	};
+	unsigned int hash;          /* hash_string() of the key */
+	unsigned char queue;        /* Cache policy bookkeeping */
+	unsigned char freq;
+	union {
+		struct {                /* Cache entries: replacement policy lists */
+			struct entry *next;
+			struct entry *prev;
+		};
+		struct {                /* Database entries: order bucket list */
+			struct entry *order_next;
+			struct entry *order_prev;
+		};
+	};
 	struct entry *next_hash;
 	struct entry *prev_hash;
+	char key[DOC_NAME_LENGTH + 1];
 } entry;
 
+/*
+ * Cache holding at most `capacity` entries or, with a byte budget, entries
+ * worth at most limit_bytes. The map finds entries by key; which entry
+ * makes room for a new one is up to the replacement policy (LRU by
+ * default).
+ */
 typedef struct lru_cache {
     unsigned int capacity;
 	unsigned int size;
-	entry *head;
-	entry *tail;
 	entry **map;
+	unsigned int buckets;
+	slab_allocator *slab;
+
+	/* Cost of the cached entries and their values; no limit if 0 */
+	unsigned long used_bytes;
+	unsigned long limit_bytes;
+
+	cache_policy_type policy_type;
+	const cache_policy_ops *policy;
+	void *policy_state;
+
+	/* Optional gate keeping rarely used keys out of a full cache */
+	cache_admission *admission;
 } lru_cache;
 
-lru_cache *init_lru_cache(unsigned int cache_capacity);
+/**
+ * init_lru_cache() - Creates an empty cache whose entries and values are
+ *      allocated from the given slab allocator, evicting entries according
+ *      to the given replacement policy.
+ *
+ * @param cache_capacity: Maximum number of entries, if cache_bytes is 0.
+ * @param cache_bytes: Byte budget of the cache, or 0 to count entries.
+ *      The replacement policy then sizes its structures for the number of
+ *      entries with values of CACHE_AVG_VALUE_BYTES fitting in the budget.
+ */
+lru_cache *init_lru_cache(unsigned int cache_capacity,
+						  unsigned long cache_bytes, slab_allocator *slab,
+						  cache_policy_type policy_type);
+
+/**
+ * lru_cache_entry_cost() - Bytes an entry counts for against the budget:
+ *      the entry and its whole value, even if shared with the database.
+ */
+unsigned long lru_cache_entry_cost(entry *entry);
+
+/**
+ * doc_value_create() - Allocates a buffer of the exact size class of the
+ *      value, holding a single reference.
+ */
+doc_value *doc_value_create(slab_allocator *slab, void *value,
+							unsigned int value_len);
+
+/**
+ * doc_value_release() - Drops a reference, freeing the buffer with the
+ *      last one.
+ */
+void doc_value_release(slab_allocator *slab, doc_value *doc);
+
+/**
+ * doc_value_alloc_size() - Bytes reserved for a document buffer.
+ */
+unsigned long doc_value_alloc_size(doc_value *doc);
+
+/**
+ * entry_create() - Allocates an entry (with its key stored inline) holding
+ *      a new reference to doc. The hash of the key is kept in the entry, so
+ *      it never has to be computed again.
+ */
+entry *entry_create(slab_allocator *slab, unsigned int hash, void *key,
+					doc_value *doc);
+
+/**
+ * entry_matches() - Checks whether an entry holds the given key, comparing
+ *      the strings only if the hashes are equal.
+ */
+static inline bool entry_matches(entry *entry, unsigned int hash, void *key) {
+	return entry->hash == hash && strcmp(entry->key, (char *)key) == 0;
+}
+
+/**
+ * entry_destroy() - Returns an entry to the slab, releasing its value.
+ */
+void entry_destroy(slab_allocator *slab, entry *entry);
+
+/**
+ * entry_set_value() - Replaces the value of an entry. The buffer is
+ *      rewritten in place if no other entry shares it and the new value
+ *      falls in the same size class.
+ */
+void entry_set_value(slab_allocator *slab, entry *entry, void *value,
+					 unsigned int value_len);
+
+/**
+ * entry_share_value() - Makes entry reference doc instead of its own value.
+ */
+void entry_share_value(slab_allocator *slab, entry *entry, doc_value *doc);
+
+/**
+ * entry_drop_value() - Releases the value of an entry, leaving it empty
+ *      until it gets a new one.
+ */
+void entry_drop_value(slab_allocator *slab, entry *entry);
+
+/**
+ * entry_alloc_size() - Bytes reserved for an entry, counting its value
+ *      only if no other entry shares it.
+ */
+unsigned long entry_alloc_size(entry *entry);
 
 bool lru_cache_is_full(lru_cache *cache);
 
+/**
+ * lru_cache_enable_admission() - From now on, a key is only added to a full
+ *      cache if it was accessed recently enough to be likely reused
+ *      (see cache_admission.h); otherwise nothing is evicted for it.
+ */
+void lru_cache_enable_admission(lru_cache *cache);
+
+/**
+ * lru_cache_drop_value() / lru_cache_set_value() - Replace the value of a
+ *      cached entry, keeping the used bytes up to date. A bigger value may
+ *      leave the cache over its budget until the next lru_cache_put().
+ */
+void lru_cache_drop_value(lru_cache *cache, entry *entry);
+
+void lru_cache_set_value(lru_cache *cache, entry *entry, doc_value *doc);
+
+/**
+ * free_lru_cache() - Frees the cache structure. Its entries belong to the
+ *      slab allocator, which has to be released separately.
+ */
 void free_lru_cache(lru_cache **cache);
 
 /**
- * lru_cache_put() - Adds a new pair in our cache.
+ * lru_cache_put() - Adds a new pair in our cache, evicting the entries
+ *      chosen by the replacement policy until it fits. A value bigger than
+ *      the whole budget, or one refused by the admission gate, is not
+ *      cached.
  * 
  * @param cache: Cache where the key-value pair will be stored.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
- * @param value: Value of the pair.
- * @param evicted_key: The function will RETURN via this parameter the
- *      key removed from cache if the cache was full.
+ * @param doc: Value of the pair, allocated from the cache's slab. The cache
+ *      takes a reference to it instead of copying it.
+ * @param evicted_key: Buffer of at least DOC_NAME_LENGTH + 1 bytes. The
+ *      function will RETURN via this parameter the (first) key removed from
+ *      cache if the cache was full, or an empty string otherwise (also when
+ *      the key already existed).
  * 
  * @return - true if the key was added to the cache,
- *      false if the key already existed.
+ *      false if the key already existed or the value was not admitted.
  */
-bool lru_cache_put(lru_cache *cache, void *key, void *value,
-                   void **evicted_key);
+bool lru_cache_put(lru_cache *cache, unsigned int hash, void *key,
+				   doc_value *doc, char *evicted_key);
 
 /**
- * lru_cache_get() - Retrieves the value associated with a key.
+ * lru_cache_get() - Retrieves the value associated with a key, recording
+ *      the hit with the replacement policy.
  * 
  * @param cache: Cache where the key-value pair is stored.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
  * 
  * @return - The value associated with the key,
  *      or NULL if the key is not found.
  */
-void *lru_cache_get(lru_cache *cache, void *key);
+void *lru_cache_get(lru_cache *cache, unsigned int hash, void *key);
+
+/**
+ * lru_cache_get_entry() - Same as lru_cache_get(), but returns the whole
+ *      entry, so its value can be replaced in place.
+ */
+entry *lru_cache_get_entry(lru_cache *cache, unsigned int hash, void *key);
 
 /**
  * lru_cache_remove() - Removes a key-value pair from the cache.
  * 
  * @param cache: Cache where the key-value pair is stored.
+ * @param hash: Hash of the key (as returned by hash_string).
  * @param key: Key of the pair.
 */
 void lru_cache_remove(lru_cache *cache, unsigned int hash, void *key);
 
+/**
+ * lru_cache_clear() - Removes every pair from the cache, dropping its
+ *      references to the values.
+ *
+ * @param cache: Cache to be emptied.
+*/
+void lru_cache_clear(lru_cache *cache);
+
+/**
+ * lru_cache_rank() - Lists the cached entries in the order the replacement
+ *      policy values them, the one it would evict last first (e.g. the most
+ *      recently used one for LRU). Nothing is recorded as an access.
+ *
+ * @param cache: Cache whose entries are listed.
+ * @param entries: Array with room for cache->size entries.
+ *
+ * @return - The number of entries listed (cache->size).
+*/
+unsigned int lru_cache_rank(lru_cache *cache, entry **entries);
+
 #endif /* LRU_CACHE_H */
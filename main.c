@@ -6,149 +6,425 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <ctype.h>
+#include <limits.h>
 
 #include "load_balancer.h"
+#include "input.h"
+#include "jsonl.h"
+#include "trace.h"
 #include "lru_cache.h"
 #include "utils.h"
 #include "constants.h"
 
-void read_quoted_string(char *buffer, int buffer_len, int *start, int *end) {
-    *end = -1;
-
-    for (int i = 0; i < buffer_len && buffer[i] != '\0'; ++i) {
-        if (buffer[i] != '"')
-            continue;
-
-        if (*start == -1) {
-            *start = i;
-        } else {
-            *end = i;
-            break;
-        }
+/*
+ * Parses the cache size of ADD_SERVER: a number of entries, or a byte budget
+ * when followed by B, K, M or G (e.g. "64K").
+ */
+void parse_cache_size(char *arg, int *cache_size, unsigned long *cache_bytes)
+{
+    char *suffix;
+    unsigned long value = strtoul(arg, &suffix, 10);
+
+    *cache_size = 0;
+    *cache_bytes = 0;
+
+    switch (toupper(*suffix)) {
+    case '\0':
+        *cache_size = atoi(arg);
+        return;
+    case 'G':
+        value *= 1024;
+        /* fall through */
+    case 'M':
+        value *= 1024;
+        /* fall through */
+    case 'K':
+        value *= 1024;
+        /* fall through */
+    case 'B':
+        break;
+    default:
+        DIE(1, "invalid cache size");
     }
+
+    DIE(value == 0, "cache budget must be positive");
+    *cache_bytes = value;
 }
 
-request_type read_request_arguments(FILE *input_file, char *buffer,
+/*
+ * Parses the next request. The document name and content are views into the
+ * input mapping, valid until input_release_consumed().
+ */
+request_type read_request_arguments(input_file *input, char *buffer,
     int *maybe_server_id, int *maybe_cache_size,
-    char **maybe_doc_name, char **maybe_doc_content)
+    unsigned long *maybe_cache_bytes, int *maybe_weight,
+    cache_policy_type *maybe_cache_policy, char **maybe_doc_name,
+    char **maybe_doc_content, unsigned int *maybe_doc_content_len)
 {
     request_type req_type;
-    int word_start = -1;
-    int word_end = -1;
+    unsigned int doc_name_len;
 
-    DIE(fgets(buffer, REQUEST_LENGTH + 1, input_file) == NULL,
+    DIE(!input_peek(input, buffer, REQUEST_TYPE_LENGTH + 1),
         "insufficient requests");
 
     req_type = get_request_type(buffer);
 
     if (req_type == ADD_SERVER) {
-        *maybe_server_id = atoi(buffer + strlen(ADD_SERVER_REQUEST) + 1);
-        *maybe_cache_size = atoi(strchr(
-            buffer + strlen(ADD_SERVER_REQUEST) + 1, ' '));
+        char cache_arg[32] = "", words[2][16] = {"", ""};
+        char *policy_name = words[0];
+
+        input_read_line(input, buffer, REQUEST_LENGTH + 1);
+        sscanf(buffer + strlen(ADD_SERVER_REQUEST), "%d %31s %15s %15s",
+               maybe_server_id, cache_arg, words[0], words[1]);
+        parse_cache_size(cache_arg, maybe_cache_size, maybe_cache_bytes);
+
+        /* The weight is optional and defaults to 1 */
+        *maybe_weight = 1;
+        if (isdigit((unsigned char)words[0][0])) {
+            *maybe_weight = atoi(words[0]);
+            policy_name = words[1];
+        }
+
+        /* So is the cache policy, the last word, e.g. "ADD_SERVER 1 10 ARC" */
+        *maybe_cache_policy = get_cache_policy_type(policy_name);
     } else if (req_type == REMOVE_SERVER) {
+        input_read_line(input, buffer, REQUEST_LENGTH + 1);
         *maybe_server_id = atoi(buffer + strlen(REMOVE_SERVER_REQUEST) + 1);
     } else {
-        *maybe_doc_name = calloc(1, DOC_NAME_LENGTH + 1);
-        DIE(*maybe_doc_name == NULL, "calloc failed");
-
-        read_quoted_string(buffer, REQUEST_LENGTH, &word_start, &word_end);
-        memcpy(*maybe_doc_name, buffer + word_start + 1,
-            word_end - word_start - 1);
+        *maybe_doc_name = input_quoted(input, &doc_name_len);
+        DIE(doc_name_len > DOC_NAME_LENGTH, "document name too long");
 
         if (req_type == EDIT_DOCUMENT) {
-            char *tmp_buffer = buffer + word_end + 1;
-
-            *maybe_doc_content = calloc(1, DOC_CONTENT_LENGTH + 1);
-            DIE(*maybe_doc_content == NULL, "calloc failed");
-
-            /* Read the content, which might be a multiline quoted string */
-            word_start = -1;
-            read_quoted_string(tmp_buffer, DOC_CONTENT_LENGTH,
-                &word_start, &word_end);
-
-            if (word_end == -1)
-                strcpy(*maybe_doc_content, tmp_buffer + word_start + 1);
-            else
-                strncpy(*maybe_doc_content, tmp_buffer + word_start + 1,
-                    word_end - word_start - 1);
-
-            while (word_end == -1) {
-                DIE(fgets(buffer, DOC_CONTENT_LENGTH + 1, input_file) == NULL,
-                    "document content is not properly quoted");
-
-                read_quoted_string(buffer, DOC_CONTENT_LENGTH,
-                    &word_start, &word_end);
-                memcpy(*maybe_doc_content + strlen(*maybe_doc_content), buffer,
-                    word_end == -1 ? strlen(buffer) : (unsigned) word_end);
-            }
+            /* The content might be a multiline quoted string */
+            *maybe_doc_content = input_quoted(input,
+                                              maybe_doc_content_len);
+            DIE(*maybe_doc_content_len > DOC_CONTENT_LENGTH,
+                "document content too long");
         } else {
             *maybe_doc_content = NULL;
         }
+
+        input_skip_line(input);
     }
 
     return req_type;
 }
 
-void apply_requests(FILE  *input_file, char *buffer,
-                    int requests_num, bool enable_vnodes) {
-    char *doc_name, *doc_content;
-    int server_id, cache_size;
+/*
+ * Parses the next JSONL record into the same arguments as
+ * read_request_arguments(). The views are valid until the next record.
+ *
+ * @return - false at the end of the stream.
+ */
+bool read_jsonl_request(jsonl_reader *jsonl, request_type *req_type,
+    int *maybe_server_id, int *maybe_cache_size,
+    unsigned long *maybe_cache_bytes, int *maybe_weight,
+    cache_policy_type *maybe_cache_policy, char **maybe_doc_name,
+    char **maybe_doc_content, unsigned int *maybe_doc_content_len)
+{
+    jsonl_record rec;
+
+    if (!jsonl_next(jsonl, &rec))
+        return false;
+
+    DIE(rec.type == NULL, "record without a type");
+    *req_type = get_request_type(rec.type);
+
+    if (*req_type == ADD_SERVER || *req_type == REMOVE_SERVER) {
+        DIE(!rec.has_server_id, "missing server_id");
+        DIE(rec.server_id < 0 || rec.server_id > INT_MAX,
+            "invalid server_id");
+        *maybe_server_id = rec.server_id;
+    }
+
+    if (*req_type == ADD_SERVER) {
+        DIE(rec.cache_size == NULL, "missing cache_size");
+        parse_cache_size(rec.cache_size, maybe_cache_size, maybe_cache_bytes);
+
+        /* Same defaults as the text format */
+        DIE(rec.has_weight && (rec.weight < 1 || rec.weight > INT_MAX),
+            "invalid weight");
+        *maybe_weight = rec.has_weight ? rec.weight : 1;
+        *maybe_cache_policy = get_cache_policy_type(rec.policy ? rec.policy
+                                                                : "");
+    } else if (*req_type == EDIT_DOCUMENT || *req_type == GET_DOCUMENT) {
+        DIE(rec.doc == NULL, "missing doc");
+        DIE(rec.doc_len > DOC_NAME_LENGTH, "document name too long");
+        *maybe_doc_name = rec.doc;
+        *maybe_doc_content = NULL;
+
+        if (*req_type == EDIT_DOCUMENT) {
+            DIE(rec.content == NULL, "missing content");
+            DIE(rec.content_len > DOC_CONTENT_LENGTH,
+                "document content too long");
+            *maybe_doc_content = rec.content;
+            *maybe_doc_content_len = rec.content_len;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Where the requests come from: the text input, which says how many of them
+ * follow, a JSONL stream or a binary trace, both read up to their end.
+ */
+typedef struct request_source {
+    input_file *input;
+    jsonl_reader *jsonl;
+    trace_reader *trace;
+    int remaining;
+} request_source;
+
+/* Input streamed as JSONL: "-" (the standard input) or a .jsonl file */
+bool is_jsonl_input(const char *path)
+{
+    size_t len = strlen(path);
+
+    return !strcmp(path, "-") ||
+           (len > 6 && !strcmp(path + len - 6, ".jsonl"));
+}
+
+/*
+ * Opens the input in whichever format it is written and leaves the header
+ * options (e.g. "ENABLE_VNODES 64") in buffer.
+ */
+void open_request_source(request_source *src, const char *path,
+                         char *buffer)
+{
+    char *options;
+
+    memset(src, 0, sizeof(request_source));
+
+    if (is_jsonl_input(path)) {
+        /* The options come from a header record; no count is needed */
+        src->jsonl = open_jsonl_reader(path);
+        jsonl_read_options(src->jsonl, buffer, REQUEST_LENGTH + 1);
+        return;
+    }
+
+    src->input = open_input_file(path);
+
+    if (is_trace_file(src->input)) {
+        src->trace = open_trace_reader(src->input, buffer,
+                                       REQUEST_LENGTH + 1);
+        return;
+    }
+
+    DIE(!input_read_line(src->input, buffer, REQUEST_LENGTH + 1),
+        "empty input file");
+
+    /* The header line starts with the number of requests */
+    src->remaining = atoi(buffer);
+    options = buffer + strspn(buffer, "0123456789 \t\r");
+    memmove(buffer, options, strlen(options) + 1);
+}
+
+void close_request_source(request_source *src)
+{
+    if (src->trace)
+        close_trace_reader(&src->trace);
+
+    if (src->jsonl)
+        close_jsonl_reader(&src->jsonl);
+    else
+        close_input_file(&src->input);
+}
+
+/*
+ * Reads the next request. Its name and content are views into the input,
+ * valid until the next request is read.
+ *
+ * @return - false once every request was read.
+ */
+bool read_next_request(request_source *src, char *buffer, trace_record *rec)
+{
+    char *doc_name = NULL, *doc_content = NULL;
+    unsigned int doc_content_len = 0;
+    int server_id = 0, cache_size = 0, weight = 1;
+    unsigned long cache_bytes = 0;
+    cache_policy_type cache_policy = CACHE_POLICY_LRU;
+
+    /* Binary traces need no parsing */
+    if (src->trace)
+        return trace_next(src->trace, rec);
+
+    if (src->jsonl) {
+        if (!read_jsonl_request(src->jsonl, &rec->type, &server_id,
+                                &cache_size, &cache_bytes, &weight,
+                                &cache_policy, &doc_name, &doc_content,
+                                &doc_content_len))
+            return false;
+    } else {
+        if (src->remaining-- <= 0)
+            return false;
+
+        /* The previous request was copied wherever it had to be kept */
+        input_release_consumed(src->input);
+
+        rec->type = read_request_arguments(src->input, buffer, &server_id,
+            &cache_size, &cache_bytes, &weight, &cache_policy,
+            &doc_name, &doc_content, &doc_content_len);
+    }
+
+    if (rec->type == ADD_SERVER) {
+        DIE(cache_size < 0, "cache size must be positive");
+        DIE(weight < 1, "server weight must be positive");
+    }
+
+    rec->server_id = server_id;
+    rec->cache_size = cache_size;
+    rec->cache_bytes = cache_bytes;
+    rec->weight = weight;
+    rec->cache_policy = cache_policy;
+    rec->doc_name = doc_name;
+    rec->doc_content = doc_content;
+    rec->doc_content_len = doc_content_len;
+
+    return true;
+}
+
+/* Writes the requests as a binary trace, to be replayed later */
+void convert_requests(request_source *src, char *buffer, const char *path)
+{
+    trace_writer *writer = open_trace_writer(path, buffer);
+    trace_record rec;
+
+    while (read_next_request(src, buffer, &rec))
+        trace_write(writer, &rec);
+
+    close_trace_writer(&writer);
+}
+
+void apply_requests(request_source *src, char *buffer,
+                    bool enable_vnodes, int vnodes_count,
+                    placement_type placement_type, double load_epsilon,
+                    db_engine db_engine, bool cache_admission,
+                    bool lazy_gets, bool cache_handoff, bool worker_threads,
+                    bool memory_report) {
+    trace_record rec;
+
+    load_balancer *main = init_load_balancer(enable_vnodes, vnodes_count,
+                                             placement_type);
+
+    if (load_epsilon > 0)
+        loader_enable_bounded_loads(main, load_epsilon);
 
-    load_balancer *main = init_load_balancer(enable_vnodes);
+    loader_set_db_engine(main, db_engine);
 
-    for (int i = 0; i < requests_num; i++) {
-        request_type req_type = read_request_arguments(input_file, buffer,
-            &server_id, &cache_size, &doc_name, &doc_content);
+    if (cache_admission)
+        loader_enable_cache_admission(main);
 
-        if (req_type == ADD_SERVER) {
-            DIE(cache_size < 0, "cache size must be positive");
-            loader_add_server(main, server_id, cache_size);
-        } else if (req_type == REMOVE_SERVER) {
-            loader_remove_server(main, server_id);
+    if (lazy_gets)
+        loader_enable_lazy_gets(main);
+
+    if (cache_handoff)
+        loader_enable_cache_handoff(main);
+
+    if (worker_threads)
+        loader_enable_workers(main);
+
+    while (read_next_request(src, buffer, &rec)) {
+        if (rec.type == ADD_SERVER) {
+            loader_add_server(main, rec.server_id, rec.cache_size,
+                              rec.cache_bytes, rec.weight, rec.cache_policy);
+        } else if (rec.type == REMOVE_SERVER) {
+            loader_remove_server(main, rec.server_id);
         } else {
             request server_request = {
-                .type = req_type,
-                .doc_name = doc_name,
+                .type = rec.type,
+                .doc_name = rec.doc_name,
+                .doc_hash = main->hash_function_docs(rec.doc_name),
             };
 
-            if (req_type == EDIT_DOCUMENT) {
-                server_request.doc_content = doc_content;
+            if (rec.type == EDIT_DOCUMENT) {
+                server_request.doc_content = rec.doc_content;
+                server_request.doc_content_len = rec.doc_content_len;
             }
 
             response *response = loader_forward_request(main, &server_request);
 
-            free(server_request.doc_name);
-            free(server_request.doc_content);
-
-            PRINT_RESPONSE(response);
+            loader_print_response(main, response);
         }
     }
 
+    if (memory_report)
+        loader_memory_report(main, stderr);
+
     free_load_balancer(&main);
 }
 
 int main(int argc, char **argv) {
-    FILE *input;
-    int requests_num;
+    request_source src;
     bool enable_vnodes;
+    int vnodes_count = 0;
+    double load_epsilon = 0;
+    db_engine db_engine;
+    bool cache_admission;
+    bool lazy_gets;
+    bool cache_handoff;
+    bool worker_threads;
+    char *vnodes_arg, *bounded_arg;
 
     char buffer[REQUEST_LENGTH + 1];
 
-    if (argc < 2) {
-        printf("Usage: %s <input_file>\n", argv[0]);
+    if (argc < 2 || (!strcmp(argv[1], "--convert") && argc < 4)) {
+        printf("Usage: %s <input_file | file.jsonl | -> [--mem-report]\n"
+               "       %s --convert <input_file | file.jsonl | -> <trace>\n",
+               argv[0], argv[0]);
         return -1;
     }
 
-    input = fopen(argv[1], "rt");
-    DIE(input == NULL, "missing input file");
+    /* Rewrite any input as a binary trace, which replays faster */
+    if (!strcmp(argv[1], "--convert")) {
+        open_request_source(&src, argv[2], buffer);
+        convert_requests(&src, buffer, argv[3]);
+        close_request_source(&src);
+        return 0;
+    }
+
+    open_request_source(&src, argv[1], buffer);
+
+    vnodes_arg = strstr(buffer, "ENABLE_VNODES");
+    enable_vnodes = vnodes_arg;
+
+    /* Optional number of ring points per server, e.g. ENABLE_VNODES 128 */
+    if (enable_vnodes) {
+        vnodes_count = atoi(vnodes_arg + strlen("ENABLE_VNODES"));
+        DIE(vnodes_count < 0, "vnodes count must be positive");
+    }
+
+    /* Optional consistent hashing with bounded loads, e.g. BOUNDED_LOADS 0.5 */
+    bounded_arg = strstr(buffer, "BOUNDED_LOADS");
+    if (bounded_arg) {
+        load_epsilon = atof(bounded_arg + strlen("BOUNDED_LOADS"));
+        if (load_epsilon <= 0)
+            load_epsilon = DEFAULT_LOAD_EPSILON;
+    }
+
+    /* Optional open-addressing database tables, e.g. SWISS_DB */
+    db_engine = strstr(buffer, "SWISS_DB") ? DB_SWISS : DB_CHAINED;
+
+    /* Optional admission gate for every server cache, e.g. CACHE_ADMISSION */
+    cache_admission = strstr(buffer, "CACHE_ADMISSION");
+
+    /* Optional GETs which do not execute the queue first, e.g. LAZY_GETS */
+    lazy_gets = strstr(buffer, "LAZY_GETS");
+
+    /* Optional caching of the migrated hot documents, e.g. CACHE_HANDOFF */
+    cache_handoff = strstr(buffer, "CACHE_HANDOFF");
 
-    DIE(fgets(buffer, REQUEST_LENGTH + 1, input) == 0, "empty input file");
-    requests_num = atoi(buffer);
-    enable_vnodes = strstr(buffer, "ENABLE_VNODES");
+    /* Optional thread per server, e.g. WORKER_THREADS */
+    worker_threads = strstr(buffer, "WORKER_THREADS");
 
-    apply_requests(input, buffer, requests_num, enable_vnodes);
+    apply_requests(&src, buffer, enable_vnodes, vnodes_count,
+                   get_placement_type(buffer), load_epsilon,
+                   db_engine, cache_admission, lazy_gets, cache_handoff,
+                   worker_threads,
+                   argc > 2 && !strcmp(argv[2], "--mem-report"));
 
-    fclose(input);
+    close_request_source(&src);
 
     return 0;
 }
@@ -0,0 +1,721 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include "placement.h"
+#include "utils.h"
+
+#define MAGLEV_EMPTY_SLOT       ((unsigned int)-1)
+
+/* Adds s to the sources list, unless it is already there */
+static void add_source(server **sources, unsigned int *count, server *s)
+{
+	for (unsigned int i = 0; i < *count; i++) {
+		if (sources[i] == s) {
+			return;
+		}
+	}
+
+	sources[(*count)++] = s;
+}
+
+/* Grows a dynamic array to hold at least `needed` elements */
+static void *grow_array(void *array, unsigned int *capacity,
+						unsigned int needed, size_t elem_size)
+{
+	if (needed <= *capacity) {
+		return array;
+	}
+
+	unsigned int new_capacity = *capacity ? *capacity : 16;
+	while (new_capacity < needed) {
+		new_capacity *= 2;
+	}
+
+	array = realloc(array, new_capacity * elem_size);
+	DIE(array == NULL, "realloc failed");
+
+	*capacity = new_capacity;
+	return array;
+}
+
+/*
+ * Consistent hashing ring: sorted positions and the server owning each point.
+ * A document belongs to the first point placed strictly after its hash.
+ */
+typedef struct ring {
+	unsigned int *positions;
+	server **owners;
+	unsigned int size;
+	unsigned int capacity;
+} ring;
+
+typedef struct ring_point {
+	unsigned int position;
+	server *owner;
+} ring_point;
+
+static void ring_init(placement *p)
+{
+	p->state = calloc(1, sizeof(ring));
+	DIE(p->state == NULL, "calloc failed");
+}
+
+static void ring_free(placement *p)
+{
+	ring *r = p->state;
+
+	free(r->positions);
+	free(r->owners);
+	free(r);
+}
+
+/*
+ * Branchless upper bound: index of the first ring position strictly greater
+ * than hash, or count if there is none. Only the packed positions array is
+ * touched, so no server has to be dereferenced during the search.
+ */
+static unsigned int
+ring_upper_bound(const unsigned int *positions, unsigned int count,
+				 unsigned int hash)
+{
+	const unsigned int *base = positions;
+	unsigned int len = count;
+
+	if (count == 0) {
+		return 0;
+	}
+
+	while (len > 1) {
+		unsigned int half = len / 2;
+
+		base = (base[half] <= hash) ? base + half : base;
+		len -= half;
+	}
+
+	return (unsigned int)(base - positions) + (*base <= hash);
+}
+
+static server *ring_lookup(placement *p, unsigned int doc_hash)
+{
+	ring *r = p->state;
+	unsigned int idx = ring_upper_bound(r->positions, r->size, doc_hash);
+
+	// If the document hash is greater than the last point's position
+	// then the first point should handle the request
+	if (idx == r->size) {
+		idx = 0;
+	}
+
+	return r->owners[idx];
+}
+
+static server *ring_probe(placement *p, unsigned int doc_hash, unsigned int i)
+{
+	ring *r = p->state;
+	unsigned int idx = ring_upper_bound(r->positions, r->size, doc_hash);
+
+	if (i >= r->size) {
+		return NULL;
+	}
+
+	return r->owners[(idx + i) % r->size];
+}
+
+static int compare_ring_points(const void *a, const void *b)
+{
+	unsigned int pos_a = ((const ring_point *)a)->position;
+	unsigned int pos_b = ((const ring_point *)b)->position;
+
+	return (pos_a > pos_b) - (pos_a < pos_b);
+}
+
+/*
+ * Merges the (unsorted) new points into the ring in a single backwards pass,
+ * so adding a server with many replicas never re-sorts the whole ring.
+ */
+static void ring_insert_points(ring *r, ring_point *points, unsigned int count)
+{
+	unsigned int new_size = r->size + count;
+	unsigned int capacity = r->capacity;
+
+	r->positions = grow_array(r->positions, &capacity, new_size,
+							  sizeof(unsigned int));
+	r->owners = grow_array(r->owners, &r->capacity, new_size,
+						   sizeof(server *));
+
+	qsort(points, count, sizeof(ring_point), compare_ring_points);
+
+	// New points go after existing ones with the same position
+	int i = (int)r->size - 1;
+	int j = (int)count - 1;
+
+	for (int k = (int)new_size - 1; j >= 0; k--) {
+		if (i >= 0 && r->positions[i] > points[j].position) {
+			r->positions[k] = r->positions[i];
+			r->owners[k] = r->owners[i];
+			i--;
+		} else {
+			r->positions[k] = points[j].position;
+			r->owners[k] = points[j].owner;
+			j--;
+		}
+	}
+
+	r->size = new_size;
+}
+
+/*
+ * Owner of the first ring point after idx which belongs to another server,
+ * or NULL if the whole ring belongs to the same server.
+ */
+static server *ring_next_foreign(ring *r, unsigned int idx)
+{
+	server *own = r->owners[idx];
+
+	for (unsigned int i = 1; i < r->size; i++) {
+		server *s = r->owners[(idx + i) % r->size];
+
+		if (s != own) {
+			return s;
+		}
+	}
+
+	return NULL;
+}
+
+static unsigned int ring_add_server(placement *p, server *s, server **sources)
+{
+	ring *r = p->state;
+	unsigned int sources_count = 0;
+
+	// Generate its labels: the first one is the server itself,
+	// the others are replicas derived from (server_id, replica)
+	unsigned int points_count = p->vnodes_count * s->weight;
+	ring_point *points = malloc(points_count * sizeof(ring_point));
+	DIE(points == NULL, "malloc failed");
+
+	points[0].position = p->hash_function_servers(&s->server_id);
+	points[0].owner = s;
+	for (unsigned int i = 1; i < points_count; i++) {
+		points[i].position = hash_vnode(s->server_id, i);
+		points[i].owner = s;
+	}
+
+	ring_insert_points(r, points, points_count);
+	free(points);
+
+	// Every point takes over its arc from the next point
+	// owned by another server
+	for (unsigned int i = 0; i < r->size; i++) {
+		if (r->owners[i] == s) {
+			server *source = ring_next_foreign(r, i);
+
+			if (source) {
+				add_source(sources, &sources_count, source);
+			}
+		}
+	}
+
+	return sources_count;
+}
+
+/*
+ * Every point owns the hashes from the previous point up to its own
+ * position, so a run of consecutive points of s makes up a single arc.
+ */
+static unsigned int ring_arcs(placement *p, server *s, placement_arc *arcs)
+{
+	ring *r = p->state;
+	unsigned int count = 0;
+
+	for (unsigned int i = 0; i < r->size; i++) {
+		server *next = r->owners[(i + 1) % r->size];
+
+		// Only look at the last point of each run
+		if (r->owners[i] != s || next == s) {
+			continue;
+		}
+
+		unsigned int start = i;
+		while (r->owners[(start + r->size - 1) % r->size] == s) {
+			start = (start + r->size - 1) % r->size;
+		}
+
+		arcs[count].from = r->positions[(start + r->size - 1) % r->size];
+		arcs[count].to = r->positions[i];
+		arcs[count].neighbour = next;
+		count++;
+	}
+
+	return count;
+}
+
+static unsigned int
+ring_remove_server(placement *p, server *s, server **sources)
+{
+	ring *r = p->state;
+	unsigned int kept = 0;
+
+	(void)sources;
+
+	for (unsigned int i = 0; i < r->size; i++) {
+		if (r->owners[i] != s) {
+			r->positions[kept] = r->positions[i];
+			r->owners[kept] = r->owners[i];
+			kept++;
+		}
+	}
+
+	r->size = kept;
+
+	// Only the documents of the removed server change owner
+	return 0;
+}
+
+/*
+ * Maglev: every server walks its own permutation of a prime-sized table and
+ * claims the first free slot, in turns, until the table is full. Lookup is a
+ * single table access. A server of weight w takes w turns per round.
+ */
+typedef struct maglev {
+	server **servers;
+	unsigned int count;
+	unsigned int capacity;
+	unsigned int *table;
+} maglev;
+
+static void maglev_init(placement *p)
+{
+	maglev *m = calloc(1, sizeof(maglev));
+	DIE(m == NULL, "calloc failed");
+
+	m->table = malloc(MAGLEV_TABLE_SIZE * sizeof(unsigned int));
+	DIE(m->table == NULL, "malloc failed");
+	memset(m->table, 0xff, MAGLEV_TABLE_SIZE * sizeof(unsigned int));
+
+	p->state = m;
+}
+
+static void maglev_free(placement *p)
+{
+	maglev *m = p->state;
+
+	free(m->servers);
+	free(m->table);
+	free(m);
+}
+
+static void maglev_populate(placement *p)
+{
+	maglev *m = p->state;
+	unsigned int filled = 0;
+
+	memset(m->table, 0xff, MAGLEV_TABLE_SIZE * sizeof(unsigned int));
+	if (m->count == 0) {
+		return;
+	}
+
+	unsigned long long *offset = malloc(m->count * sizeof(*offset));
+	unsigned long long *skip = malloc(m->count * sizeof(*skip));
+	unsigned long long *next = calloc(m->count, sizeof(*next));
+	DIE(!offset || !skip || !next, "malloc failed");
+
+	for (unsigned int i = 0; i < m->count; i++) {
+		unsigned int id = m->servers[i]->server_id;
+
+		offset[i] = p->hash_function_servers(&id) % MAGLEV_TABLE_SIZE;
+		skip[i] = hash_vnode(id, 1) % (MAGLEV_TABLE_SIZE - 1) + 1;
+	}
+
+	while (filled < MAGLEV_TABLE_SIZE) {
+		for (unsigned int i = 0; i < m->count; i++) {
+			for (unsigned int w = 0; w < m->servers[i]->weight; w++) {
+				unsigned int slot;
+
+				do {
+					slot = (offset[i] + next[i] * skip[i])
+						   % MAGLEV_TABLE_SIZE;
+					next[i]++;
+				} while (m->table[slot] != MAGLEV_EMPTY_SLOT);
+
+				m->table[slot] = i;
+				if (++filled == MAGLEV_TABLE_SIZE) {
+					goto out;
+				}
+			}
+		}
+	}
+
+out:
+	free(offset);
+	free(skip);
+	free(next);
+}
+
+/*
+ * Rebuilds the table and collects the surviving servers which lost at
+ * least one slot. old_servers/old_table describe the previous table.
+ */
+static unsigned int
+maglev_rebuild(placement *p, server **old_servers, unsigned int old_count,
+			   unsigned int *old_table, server *removed, server **sources)
+{
+	maglev *m = p->state;
+	unsigned int sources_count = 0;
+	bool *seen = calloc(old_count + 1, sizeof(bool));
+	DIE(seen == NULL, "calloc failed");
+
+	maglev_populate(p);
+
+	for (unsigned int slot = 0; slot < MAGLEV_TABLE_SIZE; slot++) {
+		unsigned int old = old_table[slot];
+
+		if (old == MAGLEV_EMPTY_SLOT || seen[old] ||
+			old_servers[old] == removed) {
+			continue;
+		}
+
+		if (old_servers[old] != m->servers[m->table[slot]]) {
+			seen[old] = true;
+			sources[sources_count++] = old_servers[old];
+		}
+	}
+
+	free(seen);
+	return sources_count;
+}
+
+static unsigned int
+maglev_change(placement *p, server *added, server *removed, server **sources)
+{
+	maglev *m = p->state;
+	unsigned int old_count = m->count;
+	unsigned int sources_count;
+
+	server **old_servers = malloc((old_count + 1) * sizeof(server *));
+	unsigned int *old_table = m->table;
+	DIE(old_servers == NULL, "malloc failed");
+	if (old_count) {
+		memcpy(old_servers, m->servers, old_count * sizeof(server *));
+	}
+
+	m->table = malloc(MAGLEV_TABLE_SIZE * sizeof(unsigned int));
+	DIE(m->table == NULL, "malloc failed");
+
+	if (added) {
+		m->servers = grow_array(m->servers, &m->capacity, m->count + 1,
+								sizeof(server *));
+		m->servers[m->count++] = added;
+	} else {
+		for (unsigned int i = 0; i < m->count; i++) {
+			if (m->servers[i] == removed) {
+				memmove(&m->servers[i], &m->servers[i + 1],
+						(m->count - i - 1) * sizeof(server *));
+				m->count--;
+				break;
+			}
+		}
+	}
+
+	sources_count = maglev_rebuild(p, old_servers, old_count, old_table,
+								   removed, sources);
+
+	free(old_servers);
+	free(old_table);
+	return sources_count;
+}
+
+static unsigned int
+maglev_add_server(placement *p, server *s, server **sources)
+{
+	return maglev_change(p, s, NULL, sources);
+}
+
+static unsigned int
+maglev_remove_server(placement *p, server *s, server **sources)
+{
+	return maglev_change(p, NULL, s, sources);
+}
+
+static server *maglev_lookup(placement *p, unsigned int doc_hash)
+{
+	maglev *m = p->state;
+
+	return m->servers[m->table[doc_hash % MAGLEV_TABLE_SIZE]];
+}
+
+/*
+ * Rendezvous (highest random weight) hashing: the document goes to the label
+ * with the highest hash_vnode(label, doc_hash) score. A server of weight w
+ * owns w labels, so it wins with probability proportional to w.
+ */
+typedef struct rendezvous {
+	unsigned int *labels;
+	server **owners;
+	unsigned int count;
+	unsigned int capacity;
+} rendezvous;
+
+static void rendezvous_init(placement *p)
+{
+	p->state = calloc(1, sizeof(rendezvous));
+	DIE(p->state == NULL, "calloc failed");
+}
+
+static void rendezvous_free(placement *p)
+{
+	rendezvous *r = p->state;
+
+	free(r->labels);
+	free(r->owners);
+	free(r);
+}
+
+static unsigned int
+rendezvous_add_server(placement *p, server *s, server **sources)
+{
+	rendezvous *r = p->state;
+	unsigned int sources_count = 0;
+	unsigned int capacity = r->capacity;
+
+	// Any other server may lose documents to the new one
+	for (unsigned int i = 0; i < r->count; i++) {
+		if (i == 0 || r->owners[i] != r->owners[i - 1]) {
+			sources[sources_count++] = r->owners[i];
+		}
+	}
+
+	r->labels = grow_array(r->labels, &capacity, r->count + s->weight,
+						   sizeof(unsigned int));
+	r->owners = grow_array(r->owners, &r->capacity, r->count + s->weight,
+						   sizeof(server *));
+
+	for (unsigned int w = 0; w < s->weight; w++) {
+		r->labels[r->count] = hash_vnode(s->server_id, w);
+		r->owners[r->count] = s;
+		r->count++;
+	}
+
+	return sources_count;
+}
+
+static unsigned int
+rendezvous_remove_server(placement *p, server *s, server **sources)
+{
+	rendezvous *r = p->state;
+	unsigned int kept = 0;
+
+	(void)sources;
+
+	for (unsigned int i = 0; i < r->count; i++) {
+		if (r->owners[i] != s) {
+			r->labels[kept] = r->labels[i];
+			r->owners[kept] = r->owners[i];
+			kept++;
+		}
+	}
+
+	r->count = kept;
+
+	// Only the documents of the removed server change owner
+	return 0;
+}
+
+static server *rendezvous_lookup(placement *p, unsigned int doc_hash)
+{
+	rendezvous *r = p->state;
+	unsigned int best = 0;
+	unsigned int best_score = hash_vnode(r->labels[0], doc_hash);
+
+	for (unsigned int i = 1; i < r->count; i++) {
+		unsigned int score = hash_vnode(r->labels[i], doc_hash);
+
+		if (score > best_score) {
+			best_score = score;
+			best = i;
+		}
+	}
+
+	return r->owners[best];
+}
+
+/*
+ * Jump consistent hash: documents map to buckets [0, count), and each bucket
+ * to a server. A server of weight w owns w buckets. Removing a bucket moves
+ * the last one in its place, as jump hash can only shrink from the end.
+ */
+typedef struct jump {
+	server **buckets;
+	unsigned int count;
+	unsigned int capacity;
+} jump;
+
+static void jump_init(placement *p)
+{
+	p->state = calloc(1, sizeof(jump));
+	DIE(p->state == NULL, "calloc failed");
+}
+
+static void jump_free(placement *p)
+{
+	jump *j = p->state;
+
+	free(j->buckets);
+	free(j);
+}
+
+static unsigned int jump_consistent_hash(unsigned long long key,
+										 unsigned int num_buckets)
+{
+	long long b = -1, j = 0;
+
+	while (j < (long long)num_buckets) {
+		b = j;
+		key = key * 2862933555777941757ULL + 1;
+		j = (long long)((b + 1) *
+			((double)(1LL << 31) / (double)((key >> 33) + 1)));
+	}
+
+	return (unsigned int)b;
+}
+
+static unsigned int jump_add_server(placement *p, server *s, server **sources)
+{
+	jump *j = p->state;
+	unsigned int sources_count = 0;
+
+	// Growing the bucket count takes documents from every bucket
+	for (unsigned int i = 0; i < j->count; i++) {
+		add_source(sources, &sources_count, j->buckets[i]);
+	}
+
+	j->buckets = grow_array(j->buckets, &j->capacity, j->count + s->weight,
+							sizeof(server *));
+
+	for (unsigned int w = 0; w < s->weight; w++) {
+		j->buckets[j->count++] = s;
+	}
+
+	return sources_count;
+}
+
+static unsigned int
+jump_remove_server(placement *p, server *s, server **sources)
+{
+	jump *j = p->state;
+	unsigned int sources_count = 0;
+
+	// Walk downwards, so every bucket after i is already owned by others
+	for (unsigned int i = j->count; i-- > 0;) {
+		if (j->buckets[i] != s) {
+			continue;
+		}
+
+		j->count--;
+		if (i != j->count) {
+			// The documents of the last bucket get spread over the others
+			j->buckets[i] = j->buckets[j->count];
+			add_source(sources, &sources_count, j->buckets[i]);
+		}
+	}
+
+	return sources_count;
+}
+
+static server *jump_lookup(placement *p, unsigned int doc_hash)
+{
+	jump *j = p->state;
+
+	return j->buckets[jump_consistent_hash(doc_hash, j->count)];
+}
+
+static const placement_ops placement_engines[] = {
+	[PLACEMENT_RING] = {
+		ring_init, ring_free,
+		ring_add_server, ring_remove_server, ring_lookup, ring_probe,
+		ring_arcs
+	},
+	[PLACEMENT_MAGLEV] = {
+		maglev_init, maglev_free,
+		maglev_add_server, maglev_remove_server, maglev_lookup, NULL, NULL
+	},
+	[PLACEMENT_RENDEZVOUS] = {
+		rendezvous_init, rendezvous_free,
+		rendezvous_add_server, rendezvous_remove_server, rendezvous_lookup,
+		NULL, NULL
+	},
+	[PLACEMENT_JUMP] = {
+		jump_init, jump_free,
+		jump_add_server, jump_remove_server, jump_lookup, NULL, NULL
+	},
+};
+
+placement *init_placement(placement_type type, unsigned int vnodes_count,
+						  unsigned int (*hash_function_servers)(void *))
+{
+	placement *p = calloc(1, sizeof(placement));
+	DIE(p == NULL, "calloc failed");
+
+	p->type = type;
+	p->ops = &placement_engines[type];
+	p->vnodes_count = vnodes_count;
+	p->hash_function_servers = hash_function_servers;
+	p->ops->init(p);
+
+	return p;
+}
+
+void free_placement(placement **p)
+{
+	(*p)->ops->free(*p);
+	free(*p);
+	*p = NULL;
+}
+
+placement_type get_placement_type(char *header_line)
+{
+	if (strstr(header_line, MAGLEV_PLACEMENT))
+		return PLACEMENT_MAGLEV;
+	if (strstr(header_line, RENDEZVOUS_PLACEMENT))
+		return PLACEMENT_RENDEZVOUS;
+	if (strstr(header_line, JUMP_PLACEMENT))
+		return PLACEMENT_JUMP;
+
+	return PLACEMENT_RING;
+}
+
+server *placement_lookup(placement *p, unsigned int doc_hash)
+{
+	return p->ops->lookup(p, doc_hash);
+}
+
+server *placement_probe(placement *p, unsigned int doc_hash, unsigned int i)
+{
+	if (i == 0) {
+		return p->ops->lookup(p, doc_hash);
+	}
+
+	return p->ops->probe ? p->ops->probe(p, doc_hash, i) : NULL;
+}
+
+bool placement_has_arcs(placement *p)
+{
+	return p->ops->arcs != NULL;
+}
+
+unsigned int placement_arcs(placement *p, server *s, placement_arc *arcs)
+{
+	return p->ops->arcs(p, s, arcs);
+}
+
+unsigned int placement_add_server(placement *p, server *s, server **sources)
+{
+	return p->ops->add_server(p, s, sources);
+}
+
+unsigned int placement_remove_server(placement *p, server *s,
+									 server **sources)
+{
+	return p->ops->remove_server(p, s, sources);
+}
@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef PLACEMENT_H
+#define PLACEMENT_H
+
+#include "server.h"
+
+#define MAGLEV_TABLE_SIZE       65537
+
+#define RING_PLACEMENT          "RING"
+#define MAGLEV_PLACEMENT        "MAGLEV"
+#define RENDEZVOUS_PLACEMENT    "RENDEZVOUS"
+#define JUMP_PLACEMENT          "JUMP_HASH"
+
+typedef enum placement_type {
+	PLACEMENT_RING,
+	PLACEMENT_MAGLEV,
+	PLACEMENT_RENDEZVOUS,
+	PLACEMENT_JUMP
+} placement_type;
+
+typedef struct placement placement;
+
+/*
+ * Document hashes in [from, to), wrapping around past the largest hash when
+ * to < from, and the server owning the hashes right after them.
+ */
+typedef struct placement_arc {
+	unsigned int from;
+	unsigned int to;
+	server *neighbour;
+} placement_arc;
+
+/*
+ * Operations every placement engine implements. add_server and remove_server
+ * fill `sources` with the remaining servers which may have lost documents
+ * because of the change and return how many there are; the array must have
+ * room for every server in the system. Engines which map contiguous hash
+ * ranges to servers also implement arcs, which lists the ranges a server
+ * owns (NULL otherwise).
+ */
+typedef struct placement_ops {
+	void (*init)(placement *p);
+	void (*free)(placement *p);
+	unsigned int (*add_server)(placement *p, server *s, server **sources);
+	unsigned int (*remove_server)(placement *p, server *s, server **sources);
+	server *(*lookup)(placement *p, unsigned int doc_hash);
+	server *(*probe)(placement *p, unsigned int doc_hash, unsigned int i);
+	unsigned int (*arcs)(placement *p, server *s, placement_arc *arcs);
+} placement_ops;
+
+struct placement {
+	const placement_ops *ops;
+	placement_type type;
+	unsigned int (*hash_function_servers)(void *);
+	unsigned int vnodes_count;
+	void *state;
+};
+
+/**
+ * init_placement() - Creates an empty placement engine.
+ *
+ * @param type: Algorithm used to map document hashes to servers.
+ * @param vnodes_count: Ring points per unit of server weight (only used
+ *        by the ring).
+ * @param hash_function_servers: Hash used for server labels.
+ */
+placement *init_placement(placement_type type, unsigned int vnodes_count,
+						  unsigned int (*hash_function_servers)(void *));
+
+void free_placement(placement **p);
+
+/**
+ * get_placement_type() - Finds the engine named in the first line of the
+ *      input file (e.g. "100 MAGLEV"). The ring is used by default.
+ */
+placement_type get_placement_type(char *header_line);
+
+/**
+ * placement_lookup() - Returns the server owning a document hash.
+ */
+server *placement_lookup(placement *p, unsigned int doc_hash);
+
+/**
+ * placement_probe() - Returns the owner of the i-th candidate location of a
+ *      document hash, the 0-th one being placement_lookup(), or NULL when
+ *      there are no more candidates. On the ring, candidates are the
+ *      following points, wrapping around once; other engines only have
+ *      the 0-th one.
+ */
+server *placement_probe(placement *p, unsigned int doc_hash, unsigned int i);
+
+/**
+ * placement_has_arcs() - Whether the engine maps contiguous hash ranges to
+ *      servers, so that placement_arcs() can be used.
+ */
+bool placement_has_arcs(placement *p);
+
+/**
+ * placement_arcs() - Fills arcs with the hash ranges owned by a server, each
+ *      with the server owning what follows it: right after the server is
+ *      added, the one which owned the range before; right before it is
+ *      removed, the one which will own it.
+ *
+ * @param arcs: Room for vnodes_count * s->weight arcs.
+ *
+ * @return The number of arcs, 0 if the server owns every hash.
+ */
+unsigned int placement_arcs(placement *p, server *s, placement_arc *arcs);
+
+/**
+ * placement_add_server() - Adds a server to the engine.
+ *
+ * @param sources: Filled with the servers which may have lost documents
+ *        to the new placement.
+ *
+ * @return The number of servers stored in sources.
+ */
+unsigned int placement_add_server(placement *p, server *s, server **sources);
+
+/**
+ * placement_remove_server() - Removes a server from the engine.
+ *
+ * @param sources: Filled with the remaining servers which may have lost
+ *        documents to the new placement. The documents of the removed
+ *        server always have to be moved.
+ *
+ * @return The number of servers stored in sources.
+ */
+unsigned int placement_remove_server(placement *p, server *s,
+									 server **sources);
+
+#endif /* PLACEMENT_H */
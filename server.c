@@ -10,52 +10,113 @@
 
 response *create_response(server *s);
 
+static void server_free_request(server *s, request *req) {
+	slab_free(s->slab, req->doc_name, strlen(req->doc_name) + 1);
+	if (req->doc_content) {
+		slab_free(s->slab, req->doc_content, req->doc_content_len + 1);
+	}
+	slab_free(s->slab, req, sizeof(request));
+}
+
+static request *request_queue_at(request_queue *queue, unsigned int i) {
+	return queue->requests[(queue->head + i) % queue->capacity];
+}
+
+/* Latest queued EDIT of a document, or NULL */
+static request *request_queue_find(request_queue *queue, unsigned int hash,
+								   char *doc_name) {
+	request *req = queue->pending[hash % PENDING_BUCKETS];
+
+	for (; req; req = req->next_pending) {
+		if (req->doc_hash == hash && strcmp(req->doc_name, doc_name) == 0) {
+			return req;
+		}
+	}
+
+	return NULL;
+}
+
+static void request_queue_push(request_queue *queue, request *req) {
+	queue->requests[(queue->head + queue->size) % queue->capacity] = req;
+	queue->size++;
+
+	// Newer EDITs go in front of the older ones of the same document
+	if (req->type == EDIT_DOCUMENT) {
+		request **bucket = &queue->pending[req->doc_hash % PENDING_BUCKETS];
+
+		req->next_pending = *bucket;
+		*bucket = req;
+	}
+}
+
+static request *request_queue_pop(request_queue *queue) {
+	request *req = queue->requests[queue->head];
+
+	queue->head = (queue->head + 1) % queue->capacity;
+	queue->size--;
+
+	if (req->type == EDIT_DOCUMENT) {
+		request **slot = &queue->pending[req->doc_hash % PENDING_BUCKETS];
+
+		while (*slot != req) {
+			slot = &(*slot)->next_pending;
+		}
+		*slot = req->next_pending;
+	}
+
+	return req;
+}
+
 static response
-*server_edit_document(server *s, char *doc_name, char *doc_content) {
+*server_edit_document(server *s, unsigned int doc_hash, char *doc_name,
+					  char *doc_content, unsigned int doc_content_len) {
 	// Allocate response memory
 	response *resp = create_response(s);
 
 	// Key of the evicted entry
-	void *evicted_key = NULL;
+	char evicted_key[DOC_NAME_LENGTH + 1] = "";
 
-	// Get the value from the cache
-	void *value = lru_cache_get(s->cache, doc_name);
+	// Get the entry from the cache
+	entry *cached = lru_cache_get_entry(s->cache, doc_hash, doc_name);
+	entry *stored;
 
 	// If the document is in the cache
-	if (value) {
-		// Update the cache
-		memset(value, 0, DOC_CONTENT_LENGTH);
-		memcpy(value, doc_content, strlen(doc_content));
+	if (cached) {
+		// Let go of the cached value, so that the database buffer it
+		// shares is rewritten in place
+		lru_cache_drop_value(s->cache, cached);
 
 		// Update the database
-		value = db_get(s->db, doc_name);
-		if (value) {
-			memset(value, 0, DOC_CONTENT_LENGTH);
-			memcpy(value, doc_content, strlen(doc_content));
+		stored = db_get_entry(s->db, doc_hash, doc_name);
+		if (stored) {
+			entry_set_value(s->slab, stored, doc_content, doc_content_len);
 		} else {
-			db_put(s->db, doc_name, doc_content);
+			stored = db_put(s->db, doc_hash, doc_name, doc_content,
+							doc_content_len);
 		}
 
+		// Update the cache
+		lru_cache_set_value(s->cache, cached, stored->doc);
+
 		// Server resp + log
 		sprintf(resp->server_response, MSG_B, doc_name);
 		sprintf(resp->server_log, LOG_HIT, doc_name);
 	} else {
-		// Get the value from the database
-		value = db_get(s->db, doc_name);
+		// Get the entry from the database
+		stored = db_get_entry(s->db, doc_hash, doc_name);
 
 		// If the document is in the database
-		if (value) {
+		if (stored) {
 			// Update the database
-			memset(value, 0, DOC_CONTENT_LENGTH);
-			memcpy(value, doc_content, strlen(doc_content));
+			entry_set_value(s->slab, stored, doc_content, doc_content_len);
 
 			// Add entry in cache
-			lru_cache_put(s->cache, doc_name, doc_content, &evicted_key);
+			lru_cache_put(s->cache, doc_hash, doc_name, stored->doc,
+						  evicted_key);
 
 			// Server log
-			if (evicted_key) {
-				sprintf(resp->server_log, LOG_EVICT, doc_name,
-						(char *)evicted_key);
+			if (evicted_key[0]) {
+				sprintf(resp->server_log, LOG_EVICT, doc_name, evicted_key);
 			} else {
 				sprintf(resp->server_log, LOG_MISS, doc_name);
 			}
@@ -64,15 +125,16 @@ static response
 			sprintf(resp->server_response, MSG_B, doc_name);
 		} else {
 			// Add entry in database
-			db_put(s->db, doc_name, doc_content);
+			stored = db_put(s->db, doc_hash, doc_name, doc_content,
+							doc_content_len);
 
 			// Add entry in cache
-			lru_cache_put(s->cache, doc_name, doc_content, &evicted_key);
+			lru_cache_put(s->cache, doc_hash, doc_name, stored->doc,
+						  evicted_key);
 
 			// Server log
-			if (evicted_key) {
-				sprintf(resp->server_log, LOG_EVICT, doc_name,
-						(char *)evicted_key);
+			if (evicted_key[0]) {
+				sprintf(resp->server_log, LOG_EVICT, doc_name, evicted_key);
 			} else {
 				sprintf(resp->server_log, LOG_MISS, doc_name);
 			}
@@ -82,46 +144,41 @@ static response
 		}
 	}
 
-	// Free the evicted key
-	if (evicted_key) {
-		free(evicted_key);
-	}
-
 	return resp;
 }
 
 static response
-*server_get_document(server *s, char *doc_name) {
+*server_get_document(server *s, unsigned int doc_hash, char *doc_name) {
 	// Allocate response memory
 	response *resp = create_response(s);
 
 	// Key of the evicted entry
-	void *evicted_key = NULL;
+	char evicted_key[DOC_NAME_LENGTH + 1] = "";
 
 	// Get the value from the cache
-	void *value = lru_cache_get(s->cache, doc_name);
+	entry *cached = lru_cache_get_entry(s->cache, doc_hash, doc_name);
 
 	// If the document is in the cache
-	if (value) {
+	if (cached) {
 		// Server resp + log
-		sprintf(resp->server_response, "%s", (char *)value);
+		resp->value = cached->doc->data;
 		sprintf(resp->server_log, LOG_HIT, doc_name);
 	} else {
-		// Get the value from the database
-		value = db_get(s->db, doc_name);
+		// Get the entry from the database
+		entry *stored = db_get_entry(s->db, doc_hash, doc_name);
 
 		// If the document is in the database
-		if (value) {
-			// Server resp
-			sprintf(resp->server_response, "%s", (char *)value);
+		if (stored) {
+			// Server resp, which the cache now shares
+			resp->value = stored->doc->data;
 
-			// New entry in cache
-			lru_cache_put(s->cache, doc_name, value, &evicted_key);
+			// New entry in cache, sharing the stored value
+			lru_cache_put(s->cache, doc_hash, doc_name, stored->doc,
+						  evicted_key);
 
 			// Server log
-			if (evicted_key) {
-				sprintf(resp->server_log, LOG_EVICT, doc_name,
-						(char *)evicted_key);
+			if (evicted_key[0]) {
+				sprintf(resp->server_log, LOG_EVICT, doc_name, evicted_key);
 			} else {
 				sprintf(resp->server_log, LOG_MISS, doc_name);
 			}
@@ -134,35 +191,132 @@ static response
 		}
 	}
 
-	// Free the evicted key
-	if (evicted_key) {
-		free(evicted_key);
+	return resp;
+}
+
+/*
+ * Answers an EDIT whose content a later EDIT of the same document overwrites
+ * anyway. If the document is cached, this is a cache hit with the same
+ * response and cache bookkeeping as server_edit_document(), but without
+ * writing the value. Returns NULL if it is not cached.
+ */
+static response *server_coalesce_edit(server *s, request *req) {
+	if (!lru_cache_get_entry(s->cache, req->doc_hash, req->doc_name)) {
+		return NULL;
+	}
+
+	response *resp = create_response(s);
+
+	sprintf(resp->server_response, MSG_B, req->doc_name);
+	sprintf(resp->server_log, LOG_HIT, req->doc_name);
+
+	return resp;
+}
+
+/* Number of EDITs of the same document at the head of the queue */
+static unsigned int server_edit_run(request_queue *queue) {
+	request *first = request_queue_at(queue, 0);
+	unsigned int run = 1;
+
+	while (run < queue->size) {
+		request *next = request_queue_at(queue, run);
+
+		if (next->type != EDIT_DOCUMENT || next->doc_hash != first->doc_hash ||
+			strcmp(next->doc_name, first->doc_name) != 0) {
+			break;
+		}
+		run++;
+	}
+
+	return run;
+}
+
+/*
+ * Executes the run of EDITs of one document at the head of the queue, last
+ * writer wins. The first EDIT decides the fate of the document as usual;
+ * a counted cache does not care about the size of the value, so there it
+ * may as well write the final content at once. After it the document is
+ * normally cached, and the following EDITs are plain hits; the last one
+ * still writes its content if it is not in place yet. Whenever the
+ * document is not cached, an EDIT runs in full, with its own content.
+ */
+static void server_execute_edit_run(server *s) {
+	request_queue *queue = s->request_queue;
+	unsigned int run = server_edit_run(queue);
+	request *last = request_queue_at(queue, run - 1);
+
+	// Whether the stored content is already the last one
+	bool written = run > 1 && s->cache->limit_bytes == 0;
+
+	for (unsigned int i = 0; i < run; i++) {
+		request *req = request_queue_pop(queue);
+		response *resp = NULL;
+
+		if (i > 0 && (written || req != last)) {
+			resp = server_coalesce_edit(s, req);
+		}
+
+		if (!resp) {
+			request *source = i == 0 && written ? last : req;
+
+			resp = server_edit_document(s, req->doc_hash, req->doc_name,
+										source->doc_content,
+										source->doc_content_len);
+			written = source == last;
+		}
+
+		// The last request is still needed as a source until it is popped
+		server_free_request(s, req);
+		server_print_response(s, resp);
+	}
+}
+
+/*
+ * GET which leaves the queue alone: the latest queued EDIT of the document
+ * has its content, otherwise no queued request touches it and the cache and
+ * database are up to date.
+ */
+static response *server_get_lazy(server *s, request *req) {
+	request *pending = request_queue_find(s->request_queue, req->doc_hash,
+										  req->doc_name);
+
+	if (!pending) {
+		return server_get_document(s, req->doc_hash, req->doc_name);
 	}
 
+	response *resp = create_response(s);
+
+	// The EDIT stays queued until the response is printed
+	resp->value = pending->doc_content;
+	sprintf(resp->server_log, LOG_PENDING, req->doc_name);
+
 	return resp;
 }
 
-server *init_server(unsigned int server_id, unsigned int cache_size) {
+server *init_server(unsigned int server_id, unsigned int cache_size,
+					unsigned long cache_bytes, cache_policy_type cache_policy,
+					db_engine db_engine) {
 	// Allocate server memory
     server *s = malloc(sizeof(server));
 	DIE(s == NULL, "malloc failed");
 
-	// Initialize server id and hash ring position
+	// Initialize server id and weight
 	s->server_id = server_id;
-	s->hash_ring_position = hash_uint(&server_id);
+	s->weight = 1;
 
-	// Initialize the LRU cache
-	s->cache = init_lru_cache(cache_size);
+	// Entries, values and queued requests are all carved from the slab
+	s->slab = init_slab_allocator();
 
-	// Initialize the database
-	s->db = malloc(sizeof(db));
-	DIE(s->db == NULL, "calloc failed");
+	// Initialize the cache
+	s->cache = init_lru_cache(cache_size, cache_bytes, s->slab, cache_policy);
 
-	s->db->map = calloc(MAX_DB_BUCKETS, sizeof(entry *));
-	DIE(s->db->map == NULL, "calloc failed");
+	// Initialize the database
+	s->db = init_db(s->slab, db_engine);
 
-	s->db->capacity = MAX_DB_BUCKETS;
-	s->db->size = 0;
+	// Requests run on the caller's thread; the load balancer sets the output
+	s->lazy_gets = false;
+	s->worker = NULL;
+	s->out = NULL;
 
 	// Initialize the request queue
 	s->request_queue = malloc(sizeof(request_queue));
@@ -172,8 +326,12 @@ server *init_server(unsigned int server_id, unsigned int cache_size) {
 	DIE(s->request_queue->requests == NULL, "calloc failed");
 
 	s->request_queue->capacity = TASK_QUEUE_SIZE;
+	s->request_queue->head = 0;
 	s->request_queue->size = 0;
 
+	s->request_queue->pending = calloc(PENDING_BUCKETS, sizeof(request *));
+	DIE(s->request_queue->pending == NULL, "calloc failed");
+
 	return s;
 }
 
@@ -183,34 +341,36 @@ server_enqueue_request(server *server, request *req, bool make_response) {
 	request_queue *queue = server->request_queue;
 	if (queue->size < queue->capacity) {
 		// Allocate request memory
-		request *request = calloc(1, sizeof(struct request));
-		DIE(request == NULL, "calloc failed");
+		request *request = slab_alloc(server->slab, sizeof(struct request));
+		unsigned int name_len = strlen(req->doc_name);
 
 		request->type = req->type;
+		request->doc_hash = req->doc_hash;
 
 		// Copy the document name
-		request->doc_name = calloc(DOC_NAME_LENGTH, sizeof(char));
-		DIE(request->doc_name == NULL, "calloc failed");
-
-		memcpy(request->doc_name, req->doc_name, strlen(req->doc_name));
+		request->doc_name = slab_alloc(server->slab, name_len + 1);
+		memcpy(request->doc_name, req->doc_name, name_len + 1);
 
-		// Copy the document content if it exists
+		// Copy the document content if it exists, with its exact size
 		if (req->doc_content) {
-			request->doc_content = calloc(DOC_CONTENT_LENGTH, sizeof(char));
+			request->doc_content = slab_alloc(server->slab,
+											  req->doc_content_len + 1);
+
 			memcpy(request->doc_content, req->doc_content,
-				   strlen(req->doc_content));
-			DIE(request->doc_content == NULL, "calloc failed");
+				   req->doc_content_len);
+			request->doc_content[req->doc_content_len] = '\0';
+			request->doc_content_len = req->doc_content_len;
 		} else {
 			request->doc_content = NULL;
+			request->doc_content_len = 0;
 		}
 
 		// Add the request to the queue
-		queue->requests[queue->size] = request;
-		queue->size++;
+		request_queue_push(queue, request);
 	} else {
 		// If the queue is full, execute all requests
 		server_execute_all_requests(server);
-		server_enqueue_request(server, req, make_response);
+		server_enqueue_request(server, req, false);
 	}
 
 	// If the request is an edit request, make the response
@@ -232,43 +392,47 @@ response *
 server_execute_all_requests(server *s) {
 	// Get the request queue
 	request_queue *queue = s->request_queue;
-	int i = 0;
 
-	// Execute all requests
+	// Execute all requests, oldest first
 	while (queue->size > 0) {
-		request *req = queue->requests[i];
+		request *req = request_queue_at(queue, 0);
 		response *resp = NULL;
 
 		// Execute the request based on the type
 		switch (req->type) {
 			case EDIT_DOCUMENT:
-				// Execute the request and print the response
-				resp = server_edit_document(s, req->doc_name,
-											req->doc_content);
-				free(req->doc_name);
-				free(req->doc_content);
-				free(req);
-				PRINT_RESPONSE(resp);
+				// Execute it, and the EDITs of the same document right after
+				// it, printing the responses
+				server_execute_edit_run(s);
 				break;
 			case GET_DOCUMENT:
 				// Execute the request and return the response
-				resp = server_get_document(s, req->doc_name);
-				free(req->doc_name);
-				free(req->doc_content);
-				free(req);
-				queue->size = 0;
+				request_queue_pop(queue);
+				resp = server_get_document(s, req->doc_hash, req->doc_name);
+				server_free_request(s, req);
 				return resp;
 			default:
+				request_queue_pop(queue);
+				server_free_request(s, req);
 				break;
 		}
-
-		i++;
-		queue->size--;
 	}
 
 	return NULL;
 }
 
+void server_print_response(server *s, response *resp) {
+	server_write_response(s->out, resp);
+}
+
+void server_write_response(output_buffer *out, response *resp) {
+	if (resp) {
+		output_printf(out, GENERIC_MSG, resp->server_id,
+					  resp->value ? resp->value : resp->server_response,
+					  resp->server_id, resp->server_log);
+	}
+}
+
 response *server_handle_request(server *s, request *req) {
 	response *resp = NULL;
 	bool make_response;
@@ -281,6 +445,11 @@ response *server_handle_request(server *s, request *req) {
 		resp = server_enqueue_request(s, req, make_response);
 		break;
 	case GET_DOCUMENT:
+		if (s->lazy_gets) {
+			resp = server_get_lazy(s, req);
+			break;
+		}
+
 		// Add the request to the queue, then execute all requests in the queue
 		make_response = false;
 		server_enqueue_request(s, req, make_response);
@@ -293,36 +462,66 @@ response *server_handle_request(server *s, request *req) {
 	return resp;
 }
 
+unsigned int server_load(server *s) {
+	return s->db->size + s->request_queue->size;
+}
+
+bool server_has_document(server *s, unsigned int doc_hash, char *doc_name) {
+	if (db_get(s->db, doc_hash, doc_name)) {
+		return true;
+	}
+
+	return request_queue_find(s->request_queue, doc_hash, doc_name) != NULL;
+}
+
+unsigned long server_memory_usage(server *s, unsigned long *db_bytes,
+								  unsigned long *cache_bytes) {
+	db_iterator it;
+	entry *e;
+
+	*db_bytes = db_index_bytes(s->db);
+	db_iter_init(&it, s->db);
+	while ((e = db_iter_next(&it))) {
+		*db_bytes += entry_alloc_size(e);
+
+		// Values shared with the cache are counted with the database
+		if (e->doc->refs > 1) {
+			*db_bytes += doc_value_alloc_size(e->doc);
+		}
+	}
+	db_iter_end(&it);
+
+	*cache_bytes = s->cache->buckets * sizeof(entry *);
+	for (unsigned int i = 0; i < s->cache->buckets; i++) {
+		for (entry *e = s->cache->map[i]; e; e = e->next_hash) {
+			*cache_bytes += entry_alloc_size(e);
+		}
+	}
+
+	return *db_bytes + *cache_bytes;
+}
+
 void free_server(server **s) {
 	free_lru_cache(&(*s)->cache);
 	free_db(&(*s)->db);
-	for (unsigned int i = 0; i < (*s)->request_queue->size; i++) {
-		free((*s)->request_queue->requests[i]->doc_name);
-		free((*s)->request_queue->requests[i]->doc_content);
-		free((*s)->request_queue->requests[i]);
-	}
 	free((*s)->request_queue->requests);
+	free((*s)->request_queue->pending);
 	free((*s)->request_queue);
-	free(*s);
-	*s = NULL;
-}
 
-void free_virtual_server(server **s) {
+	// Entries, values and queued requests go away with their slab at once
+	free_slab_allocator(&(*s)->slab);
 	free(*s);
 	*s = NULL;
 }
 
+/* Clears the server's response for a new request */
 response *create_response(server *s) {
-	response *resp = calloc(1, sizeof(response));
-	DIE(resp == NULL, "calloc failed");
-
-	resp->server_response = calloc(MAX_RESPONSE_LENGTH, sizeof(char));
-	DIE(resp->server_response == NULL, "calloc failed");
-
-	resp->server_log = calloc(MAX_LOG_LENGTH, sizeof(char));
-	DIE(resp->server_log == NULL, "calloc failed");
+	response *resp = &s->response;
 
+	resp->server_log[0] = '\0';
+	resp->server_response[0] = '\0';
 	resp->server_id = s->server_id;
+	resp->value = NULL;
 
 	return resp;
 }
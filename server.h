@@ -8,42 +8,103 @@
 #include "utils.h"
 #include "constants.h"
 #include "lru_cache.h"
+#include "swiss_table.h"
 
 #define TASK_QUEUE_SIZE         1000
+#define PENDING_BUCKETS         1024
 #define MAX_LOG_LENGTH          1000
-#define MAX_RESPONSE_LENGTH     4096
-#define MAX_DB_BUCKETS			1000
+#define MAX_RESPONSE_LENGTH     (DOC_NAME_LENGTH + 64)
 
 typedef struct request {
 	request_type type;
 	char *doc_name;
 	char *doc_content;
+	unsigned int doc_content_len;
+	unsigned int doc_hash;      /* Computed once, when the request is read */
+	struct request *next_pending;
 } request;
 
+/*
+ * Every server owns a single response, reused for each request: it is
+ * printed before the server handles anything else. A document is printed
+ * straight from the value holding it, which stays untouched until then.
+ */
 typedef struct response {
-	char *server_log;
-	char *server_response;
+	char server_log[MAX_LOG_LENGTH];
+	char server_response[MAX_RESPONSE_LENGTH];
 	unsigned int server_id;
+
+	/* Printed instead of server_response if set, e.g. by a GET */
+	const char *value;
 } response;
 
+/*
+ * Ring buffer of the requests waiting to be executed, oldest at head. The
+ * queued EDITs are also indexed by document, newest first in each bucket.
+ */
 typedef struct request_queue {
 	request **requests;
+	unsigned int head;
 	unsigned int size;
 	unsigned int capacity;
+
+	request **pending;
 } request_queue;
 
+/* How a database indexes its entries */
+typedef enum db_engine {
+	DB_CHAINED,     /* Separate chaining, resized incrementally */
+	DB_SWISS        /* Open addressing with SIMD-probed control bytes */
+} db_engine;
+
 typedef struct db {
+	db_engine engine;
 	unsigned int size;
+
+	/* DB_SWISS: the whole index */
+	swiss_table swiss;
+
+	/* DB_CHAINED: bucket array */
 	unsigned int capacity;
 	entry **map;
+
+	/* New table while a resize is in progress, and the next bucket of
+	 * map to be moved into it */
+	entry **rehash_map;
+	unsigned int rehash_capacity;
+	unsigned int rehash_index;
+	unsigned int iterators;
+
+	/* The same entries, in 2^order_bits buckets picked by the top bits of
+	 * their hash, so that walking the buckets follows the hash order */
+	entry **order;
+	unsigned int order_bits;
+
+	slab_allocator *slab;
 } db;
 
+typedef struct server_worker server_worker;
+
 typedef struct server {
 	unsigned int server_id;
-	unsigned int hash_ring_position;
+	unsigned int weight;
 	request_queue *request_queue;
 	lru_cache *cache;
 	db *db;
+	slab_allocator *slab;
+
+	/* GETs are answered without executing the queue first */
+	bool lazy_gets;
+
+	/* Thread handling the server's requests, if not the main one */
+	server_worker *worker;
+
+	/* Where responses are written: the load balancer's output, or the
+	 * buffer of the task its worker is running */
+	output_buffer *out;
+
+	/* The response being built, see struct response */
+	response response;
 } server;
 
 /**
@@ -51,28 +112,26 @@ typedef struct server {
  * 				cache_size.
  *
  * @param server_id: ID of the server.
- * @param cache_size: Size of the cache.
+ * @param cache_size: Size of the cache, in entries.
+ * @param cache_bytes: Byte budget of the cache instead, if not 0.
+ * @param cache_policy: Replacement policy of the cache.
+ * @param db_engine: Table used by the server's database.
  *
  * @return server*: The newly created server.
  */
 
-server *init_server(unsigned int server_id, unsigned int cache_size);
+server *init_server(unsigned int server_id, unsigned int cache_size,
+					unsigned long cache_bytes, cache_policy_type cache_policy,
+					db_engine db_engine);
 
 /**
  * @brief Deallocates completely the memory used by server,
  *     taking care of deallocating the elements in the queue, if any,
- *     without executing the tasks
+ *     without executing the tasks. Everything allocated from the server's
+ *     slab is released in bulk.
  */
 void free_server(server **s);
 
-/**
- * free_virtual_server() - Deallocates the memory used by a
- *			virtual server.
- * @param s: Server to be deallocated.
- */
-
-void free_virtual_server(server **s);
-
 /**
  * server_handle_request() - Receives a request from the load balancer
  *      and processes it according to the request type
@@ -80,16 +139,30 @@ void free_virtual_server(server **s);
  * @param s: Server which processes the request.
  * @param req: Request to be processed.
  * 
- * @return response*: Response of the requested operation, which will
- *      then be printed in main.
+ * @return response*: Response of the requested operation, which has to
+ *      be printed before the server handles anything else.
  * 
  * @brief Based on the type of request, should call the appropriate
  *     solver, and should execute the tasks from queue if needed (in
- *     this case, after executing each task, PRINT_RESPONSE should
- *     be called).
+ *     this case, the response of each task is printed right away). With
+ *     lazy_gets, a GET is answered from the latest queued EDIT of the
+ *     document, or else from the cache and database, and the queue is
+ *     left alone.
  */
 response *server_handle_request(server *s, request *req);
 
+/**
+ * server_print_response() - Appends a response to the server's output
+ *      buffer. NULL responses are ignored.
+ */
+void server_print_response(server *s, response *resp);
+
+/**
+ * server_write_response() - Appends a response to the given buffer, in the
+ *      GENERIC_MSG format. NULL responses are ignored.
+ */
+void server_write_response(output_buffer *out, response *resp);
+
 /**
  * server_enqueue_request() - Adds a request to the server's queue.
  *
@@ -116,8 +189,32 @@ response *server_enqueue_request(server *server, request *req,
  * @return response*: Response of the GET request or NULL.
  *
  * @brief Executes all the requests in the queue until it finds a GET
- *    request, then returns the response of that request.
+ *    request, then returns the response of that request. Consecutive EDITs
+ *    of the same document write only the last content, but each of them
+ *    still prints the response it would have printed on its own.
  */
 response *server_execute_all_requests(server *server);
 
+/**
+ * server_load() - Number of documents stored on the server plus the
+ *      requests waiting in its queue.
+ */
+unsigned int server_load(server *s);
+
+/**
+ * server_memory_usage() - Bytes held by the server's database and cache
+ *      (entries, keys, values and bucket arrays). A value shared by both
+ *      is counted once, with the database.
+ *
+ * @return The sum of db_bytes and cache_bytes.
+ */
+unsigned long server_memory_usage(server *s, unsigned long *db_bytes,
+								  unsigned long *cache_bytes);
+
+/**
+ * server_has_document() - Checks whether a document is stored on the server
+ *      or has a pending EDIT in its queue.
+ */
+bool server_has_document(server *s, unsigned int doc_hash, char *doc_name);
+
 #endif  /* SERVER_H */
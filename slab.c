@@ -0,0 +1,171 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include "slab.h"
+#include "utils.h"
+
+/* Object sizes of the classes; the last one fits a full document */
+static const size_t slab_class_sizes[SLAB_CLASSES] = {
+	16, 32, 64, 128, 256, 512, 1024, 2048,
+	DOC_CONTENT_LENGTH / 2 + DOC_CONTENT_LENGTH / 4,
+	(DOC_CONTENT_LENGTH + 1 + 15) & ~(size_t)15
+};
+
+static int slab_class_index(size_t size)
+{
+	for (int i = 0; i < SLAB_CLASSES; i++) {
+		if (size <= slab_class_sizes[i]) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+size_t slab_object_size(size_t size)
+{
+	int idx = slab_class_index(size);
+
+	return idx < 0 ? size : slab_class_sizes[idx];
+}
+
+slab_allocator *init_slab_allocator(void)
+{
+	slab_allocator *slab = calloc(1, sizeof(slab_allocator));
+	DIE(slab == NULL, "calloc failed");
+
+	for (int i = 0; i < SLAB_CLASSES; i++) {
+		slab->classes[i].object_size = slab_class_sizes[i];
+	}
+
+	return slab;
+}
+
+void free_slab_allocator(slab_allocator **slab)
+{
+	slab_chunk *chunk = (*slab)->chunks;
+
+	while (chunk) {
+		slab_chunk *next = chunk->next;
+		free(chunk);
+		chunk = next;
+	}
+
+	free(*slab);
+	*slab = NULL;
+}
+
+void *slab_alloc(slab_allocator *slab, size_t size)
+{
+	int idx = slab_class_index(size);
+	void *ptr;
+
+	slab->stats.allocs++;
+
+	if (idx < 0) {
+		slab->stats.large_mallocs++;
+		ptr = malloc(size);
+		DIE(ptr == NULL, "malloc failed");
+		return ptr;
+	}
+
+	slab_class *class = &slab->classes[idx];
+
+	// Reuse a freed object first
+	if (class->free_list) {
+		ptr = class->free_list;
+		class->free_list = *(void **)ptr;
+		return ptr;
+	}
+
+	// Then carve a new one out of the current chunk
+	if (class->bump == NULL ||
+		class->bump + class->object_size > class->bump_end) {
+		slab_chunk *chunk = malloc(SLAB_CHUNK_SIZE);
+		DIE(chunk == NULL, "malloc failed");
+
+		chunk->next = slab->chunks;
+		slab->chunks = chunk;
+		slab->stats.chunk_mallocs++;
+		slab->stats.chunk_bytes += SLAB_CHUNK_SIZE;
+
+		// Keep objects 16-byte aligned after the chunk header
+		class->bump = (char *)chunk + 16;
+		class->bump_end = (char *)chunk + SLAB_CHUNK_SIZE;
+	}
+
+	ptr = class->bump;
+	class->bump += class->object_size;
+
+	return ptr;
+}
+
+void slab_free(slab_allocator *slab, void *ptr, size_t size)
+{
+	int idx = slab_class_index(size);
+
+	if (!ptr) {
+		return;
+	}
+
+	slab->stats.frees++;
+
+	if (idx < 0) {
+		free(ptr);
+		return;
+	}
+
+	slab_class *class = &slab->classes[idx];
+
+	*(void **)ptr = class->free_list;
+	class->free_list = ptr;
+}
+
+void slab_merge(slab_allocator *dst, slab_allocator *src)
+{
+	if (src->chunks) {
+		slab_chunk *last = src->chunks;
+
+		while (last->next) {
+			last = last->next;
+		}
+
+		last->next = dst->chunks;
+		dst->chunks = src->chunks;
+		src->chunks = NULL;
+	}
+
+	for (int i = 0; i < SLAB_CLASSES; i++) {
+		slab_class *from = &src->classes[i];
+		slab_class *to = &dst->classes[i];
+
+		// The unused tail of src's last chunk becomes free objects
+		while (from->bump && from->bump + from->object_size <= from->bump_end) {
+			*(void **)from->bump = from->free_list;
+			from->free_list = from->bump;
+			from->bump += from->object_size;
+		}
+		from->bump = NULL;
+		from->bump_end = NULL;
+
+		if (from->free_list) {
+			void *last = from->free_list;
+
+			while (*(void **)last) {
+				last = *(void **)last;
+			}
+
+			*(void **)last = to->free_list;
+			to->free_list = from->free_list;
+			from->free_list = NULL;
+		}
+	}
+
+	dst->stats.allocs += src->stats.allocs;
+	dst->stats.frees += src->stats.frees;
+	dst->stats.chunk_mallocs += src->stats.chunk_mallocs;
+	dst->stats.large_mallocs += src->stats.large_mallocs;
+	dst->stats.chunk_bytes += src->stats.chunk_bytes;
+	memset(&src->stats, 0, sizeof(slab_stats));
+}
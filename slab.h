@@ -0,0 +1,77 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#define SLAB_CHUNK_SIZE         (64 * 1024)
+#define SLAB_MIN_OBJECT         16
+#define SLAB_CLASSES            10
+
+typedef struct slab_chunk {
+	struct slab_chunk *next;
+} slab_chunk;
+
+typedef struct slab_class {
+	size_t object_size;
+	void *free_list;
+	char *bump;             /* Next never-used object of the last chunk */
+	char *bump_end;
+} slab_class;
+
+typedef struct slab_stats {
+	unsigned long allocs;
+	unsigned long frees;
+	unsigned long chunk_mallocs;    /* malloc calls for new chunks */
+	unsigned long large_mallocs;    /* objects too big for any class */
+	unsigned long chunk_bytes;
+} slab_stats;
+
+/*
+ * Size-classed object allocator. Objects are carved out of SLAB_CHUNK_SIZE
+ * chunks and recycled through per-class free lists, so once a server has
+ * warmed up its allocations never reach malloc. All chunks are released
+ * at once by free_slab_allocator().
+ */
+typedef struct slab_allocator {
+	slab_class classes[SLAB_CLASSES];
+	slab_chunk *chunks;
+	slab_stats stats;
+} slab_allocator;
+
+slab_allocator *init_slab_allocator(void);
+
+/**
+ * free_slab_allocator() - Releases every chunk, together with all the
+ *      objects still allocated from them.
+ */
+void free_slab_allocator(slab_allocator **slab);
+
+/**
+ * slab_alloc() - Allocates an object of the given size (uninitialized).
+ */
+void *slab_alloc(slab_allocator *slab, size_t size);
+
+/**
+ * slab_free() - Returns an object to the allocator. size must be the one
+ *      used when allocating it.
+ */
+void slab_free(slab_allocator *slab, void *ptr, size_t size);
+
+/**
+ * slab_object_size() - Bytes actually reserved for an object of the given
+ *      size, i.e. the size of its class.
+ */
+size_t slab_object_size(size_t size);
+
+/**
+ * slab_merge() - Hands every chunk and free object of src over to dst, so
+ *      objects allocated from src stay valid once it is freed and may be
+ *      released into dst. src is left empty.
+ */
+void slab_merge(slab_allocator *dst, slab_allocator *src);
+
+#endif /* SLAB_H */
@@ -0,0 +1,212 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include "swiss_table.h"
+#include "utils.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/* Bit i is set if ctrl[i] == byte, for the 16 control bytes of a group */
+static unsigned int group_match(const signed char *ctrl, signed char byte) {
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+
+	return (unsigned int)_mm_movemask_epi8(
+			_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+	unsigned int mask = 0;
+
+	for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+		mask |= (unsigned int)(ctrl[i] == byte) << i;
+	}
+
+	return mask;
+#endif
+}
+
+/* Bit i is set if slot i of the group is EMPTY or DELETED */
+static unsigned int group_match_free(const signed char *ctrl) {
+#ifdef __SSE2__
+	// Both free markers are negative, full slots hold 0..127
+	return (unsigned int)_mm_movemask_epi8(
+			_mm_loadu_si128((const __m128i *)ctrl));
+#else
+	unsigned int mask = 0;
+
+	for (int i = 0; i < SWISS_GROUP_SIZE; i++) {
+		mask |= (unsigned int)(ctrl[i] < 0) << i;
+	}
+
+	return mask;
+#endif
+}
+
+static signed char hash_tag(unsigned int hash) {
+	return (signed char)(hash & 0x7f);
+}
+
+/* First group of the probe sequence; the others follow triangularly */
+static unsigned int hash_group(swiss_table *table, unsigned int hash) {
+	return (hash >> 7) & (table->capacity / SWISS_GROUP_SIZE - 1);
+}
+
+void swiss_init(swiss_table *table, unsigned int capacity) {
+	unsigned int real_capacity = SWISS_MIN_CAPACITY;
+
+	while (real_capacity < capacity) {
+		real_capacity *= 2;
+	}
+
+	table->ctrl = malloc(real_capacity);
+	table->slots = malloc(real_capacity * sizeof(entry *));
+	table->hashes = malloc(real_capacity * sizeof(unsigned int));
+	DIE(!table->ctrl || !table->slots || !table->hashes, "malloc failed");
+
+	memset(table->ctrl, SWISS_EMPTY, real_capacity);
+	table->capacity = real_capacity;
+	table->size = 0;
+	table->deleted = 0;
+}
+
+void swiss_destroy(swiss_table *table) {
+	free(table->ctrl);
+	free(table->slots);
+	free(table->hashes);
+	table->ctrl = NULL;
+	table->slots = NULL;
+	table->hashes = NULL;
+}
+
+entry *swiss_find(swiss_table *table, unsigned int hash, const char *key) {
+	unsigned int groups_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+	unsigned int group = hash_group(table, hash);
+	signed char tag = hash_tag(hash);
+
+	for (unsigned int step = 1;; step++) {
+		const signed char *ctrl = table->ctrl + group * SWISS_GROUP_SIZE;
+		unsigned int match = group_match(ctrl, tag);
+
+		while (match) {
+			unsigned int slot = group * SWISS_GROUP_SIZE +
+								__builtin_ctz(match);
+
+			if (table->hashes[slot] == hash &&
+				strcmp(table->slots[slot]->key, key) == 0) {
+				return table->slots[slot];
+			}
+			match &= match - 1;
+		}
+
+		// An empty slot ends every probe sequence passing through it
+		if (group_match(ctrl, SWISS_EMPTY)) {
+			return NULL;
+		}
+
+		group = (group + step) & groups_mask;
+	}
+}
+
+static void swiss_place(swiss_table *table, unsigned int hash, entry *entry) {
+	unsigned int groups_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+	unsigned int group = hash_group(table, hash);
+
+	for (unsigned int step = 1;; step++) {
+		signed char *ctrl = table->ctrl + group * SWISS_GROUP_SIZE;
+		unsigned int free_slots = group_match_free(ctrl);
+
+		if (free_slots) {
+			unsigned int idx = __builtin_ctz(free_slots);
+			unsigned int slot = group * SWISS_GROUP_SIZE + idx;
+
+			if (ctrl[idx] == SWISS_DELETED) {
+				table->deleted--;
+			}
+
+			ctrl[idx] = hash_tag(hash);
+			table->slots[slot] = entry;
+			table->hashes[slot] = hash;
+			table->size++;
+			return;
+		}
+
+		group = (group + step) & groups_mask;
+	}
+}
+
+/* Rebuilds the table with the given capacity, dropping the tombstones */
+static void swiss_rehash(swiss_table *table, unsigned int capacity) {
+	swiss_table old = *table;
+
+	swiss_init(table, capacity);
+
+	for (unsigned int i = 0; i < old.capacity; i++) {
+		if (old.ctrl[i] >= 0) {
+			swiss_place(table, old.hashes[i], old.slots[i]);
+		}
+	}
+
+	swiss_destroy(&old);
+}
+
+void swiss_insert(swiss_table *table, unsigned int hash, entry *entry) {
+	// Keep at most 7/8 of the slots used, tombstones included
+	if ((table->size + table->deleted + 1) * 8 > table->capacity * 7) {
+		unsigned int capacity = table->capacity;
+
+		// Mostly tombstones: rebuilding at the same size is enough
+		if ((table->size + 1) * 2 > capacity) {
+			capacity *= 2;
+		}
+		swiss_rehash(table, capacity);
+	}
+
+	swiss_place(table, hash, entry);
+}
+
+entry *swiss_erase(swiss_table *table, unsigned int hash, const char *key) {
+	unsigned int groups_mask = table->capacity / SWISS_GROUP_SIZE - 1;
+	unsigned int group = hash_group(table, hash);
+	signed char tag = hash_tag(hash);
+
+	for (unsigned int step = 1;; step++) {
+		signed char *ctrl = table->ctrl + group * SWISS_GROUP_SIZE;
+		unsigned int match = group_match(ctrl, tag);
+
+		while (match) {
+			unsigned int idx = __builtin_ctz(match);
+			unsigned int slot = group * SWISS_GROUP_SIZE + idx;
+			entry *entry = table->slots[slot];
+
+			if (table->hashes[slot] == hash && strcmp(entry->key, key) == 0) {
+				// A group with an empty slot never made a probe go on,
+				// so the slot can become empty again
+				if (group_match(ctrl, SWISS_EMPTY)) {
+					ctrl[idx] = SWISS_EMPTY;
+				} else {
+					ctrl[idx] = SWISS_DELETED;
+					table->deleted++;
+				}
+
+				table->size--;
+				return entry;
+			}
+			match &= match - 1;
+		}
+
+		if (group_match(ctrl, SWISS_EMPTY)) {
+			return NULL;
+		}
+
+		group = (group + step) & groups_mask;
+	}
+}
+
+void swiss_shrink(swiss_table *table) {
+	if (table->capacity > SWISS_MIN_CAPACITY &&
+		table->size * 8 < table->capacity) {
+		swiss_rehash(table, table->capacity / 2);
+	}
+}
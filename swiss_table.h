@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef SWISS_TABLE_H
+#define SWISS_TABLE_H
+
+#include "lru_cache.h"
+
+#define SWISS_GROUP_SIZE        16
+#define SWISS_MIN_CAPACITY      64
+#define SWISS_EMPTY             ((signed char)-128)
+#define SWISS_DELETED           ((signed char)-2)
+
+/*
+ * Open-addressing table of entry pointers. Every slot has a control byte:
+ * EMPTY, DELETED, or the low 7 bits of the key's hash when full. Lookups
+ * compare the control bytes of a whole 16-slot group at once and only look
+ * at the stored full hash, then the key, of the matching slots, so most
+ * misses never touch an entry.
+ */
+typedef struct swiss_table {
+	signed char *ctrl;
+	entry **slots;
+	unsigned int *hashes;
+	unsigned int capacity;      /* Power of two, at least one group */
+	unsigned int size;          /* Full slots */
+	unsigned int deleted;       /* Tombstones */
+} swiss_table;
+
+void swiss_init(swiss_table *table, unsigned int capacity);
+
+void swiss_destroy(swiss_table *table);
+
+/**
+ * swiss_find() - Returns the entry stored under key, or NULL.
+ */
+entry *swiss_find(swiss_table *table, unsigned int hash, const char *key);
+
+/**
+ * swiss_insert() - Stores an entry whose key is not in the table yet,
+ *      growing the table when it gets 7/8 full.
+ */
+void swiss_insert(swiss_table *table, unsigned int hash, entry *entry);
+
+/**
+ * swiss_erase() - Unlinks the entry stored under key and returns it,
+ *      or NULL if there is none.
+ */
+entry *swiss_erase(swiss_table *table, unsigned int hash, const char *key);
+
+/**
+ * swiss_shrink() - Rebuilds the table with half the capacity when it
+ *      is mostly empty.
+ */
+void swiss_shrink(swiss_table *table);
+
+#endif /* SWISS_TABLE_H */
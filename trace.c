@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+bool is_trace_file(input_file *in) {
+	return in->size >= TRACE_MAGIC_LENGTH &&
+		   !memcmp(in->data, TRACE_MAGIC, TRACE_MAGIC_LENGTH);
+}
+
+static unsigned long trace_read_varint(input_file *in) {
+	unsigned long value = 0;
+	unsigned int shift = 0;
+
+	while (true) {
+		DIE(in->pos == in->size, "truncated trace");
+		DIE(shift >= 64, "invalid varint in trace");
+
+		unsigned char byte = in->data[in->pos++];
+
+		value |= (unsigned long)(byte & 0x7F) << shift;
+		if (!(byte & 0x80)) {
+			return value;
+		}
+		shift += 7;
+	}
+}
+
+/* String followed by its NUL, returned as a view into the mapping */
+static char *trace_read_string(input_file *in, unsigned int *len) {
+	unsigned long n = trace_read_varint(in);
+	char *str = in->data + in->pos;
+
+	DIE(n >= in->size - in->pos, "truncated trace");
+	DIE(str[n] != '\0', "unterminated string in trace");
+
+	in->pos += n + 1;
+	*len = n;
+
+	return str;
+}
+
+trace_reader *open_trace_reader(input_file *in, char *buffer, size_t size) {
+	unsigned int len;
+
+	DIE(!is_trace_file(in), "not a trace file");
+	in->pos = TRACE_MAGIC_LENGTH;
+
+	char *options = trace_read_string(in, &len);
+
+	if (len > size - 1) {
+		len = size - 1;
+	}
+	memcpy(buffer, options, len);
+	buffer[len] = '\0';
+
+	trace_reader *reader = calloc(1, sizeof(trace_reader));
+	DIE(reader == NULL, "calloc failed");
+	reader->in = in;
+
+	return reader;
+}
+
+void close_trace_reader(trace_reader **reader) {
+	free((*reader)->names);
+	free(*reader);
+	*reader = NULL;
+}
+
+static void trace_read_name(trace_reader *reader, trace_record *rec) {
+	unsigned long ref = trace_read_varint(reader->in);
+
+	if (ref) {
+		DIE(ref > reader->names_count, "unknown name in trace");
+		rec->doc_name = reader->names[ref - 1];
+		return;
+	}
+
+	unsigned int len;
+
+	rec->doc_name = trace_read_string(reader->in, &len);
+	DIE(len > DOC_NAME_LENGTH, "document name too long");
+
+	if (reader->names_count == reader->names_capacity) {
+		reader->names_capacity = reader->names_capacity
+								 ? 2 * reader->names_capacity : 1024;
+		reader->names = realloc(reader->names,
+								reader->names_capacity * sizeof(char *));
+		DIE(reader->names == NULL, "realloc failed");
+	}
+
+	reader->names[reader->names_count++] = rec->doc_name;
+}
+
+bool trace_next(trace_reader *reader, trace_record *rec) {
+	input_file *in = reader->in;
+
+	if (in->pos == in->size) {
+		return false;
+	}
+
+	// Nothing is written to the mapping, so the pages dropped here fault
+	// back in from the file and the names seen before stay valid
+	input_release_consumed(in);
+
+	memset(rec, 0, sizeof(trace_record));
+
+	switch (in->data[in->pos++]) {
+	case TRACE_ADD_SERVER:
+		rec->type = ADD_SERVER;
+		rec->server_id = trace_read_varint(in);
+		rec->cache_size = trace_read_varint(in);
+		rec->cache_bytes = trace_read_varint(in);
+		rec->weight = trace_read_varint(in);
+		DIE(rec->weight == 0, "server weight must be positive");
+
+		DIE(in->pos == in->size, "truncated trace");
+		rec->cache_policy = (unsigned char)in->data[in->pos++];
+		DIE(rec->cache_policy > CACHE_POLICY_TINYLFU,
+			"unknown cache policy in trace");
+		break;
+	case TRACE_REMOVE_SERVER:
+		rec->type = REMOVE_SERVER;
+		rec->server_id = trace_read_varint(in);
+		break;
+	case TRACE_EDIT:
+		rec->type = EDIT_DOCUMENT;
+		trace_read_name(reader, rec);
+		rec->doc_content = trace_read_string(in, &rec->doc_content_len);
+		DIE(rec->doc_content_len > DOC_CONTENT_LENGTH,
+			"document content too long");
+		break;
+	case TRACE_GET:
+		rec->type = GET_DOCUMENT;
+		trace_read_name(reader, rec);
+		break;
+	default:
+		DIE(1, "unknown request in trace");
+	}
+
+	return true;
+}
+
+static void trace_write_varint(trace_writer *writer, unsigned long value) {
+	char bytes[10];
+	unsigned int len = 0;
+
+	do {
+		bytes[len] = value & 0x7F;
+		value >>= 7;
+		if (value) {
+			bytes[len] |= 0x80;
+		}
+		len++;
+	} while (value);
+
+	output_write(&writer->out, bytes, len);
+}
+
+static void trace_write_string(trace_writer *writer, const char *str,
+							   unsigned int len) {
+	trace_write_varint(writer, len);
+	output_write(&writer->out, str, len);
+	output_write(&writer->out, "", 1);
+}
+
+trace_writer *open_trace_writer(const char *path, const char *options) {
+	trace_writer *writer = calloc(1, sizeof(trace_writer));
+	DIE(writer == NULL, "calloc failed");
+
+	writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	DIE(writer->fd < 0, "cannot create trace file");
+
+	writer->names_capacity = 1024;
+	writer->names = calloc(writer->names_capacity, sizeof(trace_name));
+	DIE(writer->names == NULL, "calloc failed");
+
+	output_write(&writer->out, TRACE_MAGIC, TRACE_MAGIC_LENGTH);
+	trace_write_string(writer, options, strlen(options));
+
+	return writer;
+}
+
+void close_trace_writer(trace_writer **writer) {
+	output_flush(&(*writer)->out, (*writer)->fd);
+	DIE(close((*writer)->fd) < 0, "close failed");
+
+	for (unsigned int i = 0; i < (*writer)->names_capacity; i++) {
+		free((*writer)->names[i].name);
+	}
+
+	free((*writer)->names);
+	free((*writer)->out.data);
+	free(*writer);
+	*writer = NULL;
+}
+
+/* Slot of the name in the dictionary, or the empty one where it would go */
+static trace_name *trace_find_name(trace_name *names, unsigned int capacity,
+								   const char *name, unsigned int hash) {
+	unsigned int i = hash & (capacity - 1);
+
+	while (names[i].name &&
+		   (names[i].hash != hash || strcmp(names[i].name, name))) {
+		i = (i + 1) & (capacity - 1);
+	}
+
+	return &names[i];
+}
+
+static void trace_grow_names(trace_writer *writer) {
+	unsigned int capacity = 2 * writer->names_capacity;
+	trace_name *names = calloc(capacity, sizeof(trace_name));
+	DIE(names == NULL, "calloc failed");
+
+	for (unsigned int i = 0; i < writer->names_capacity; i++) {
+		trace_name *old = &writer->names[i];
+
+		if (old->name) {
+			*trace_find_name(names, capacity, old->name, old->hash) = *old;
+		}
+	}
+
+	free(writer->names);
+	writer->names = names;
+	writer->names_capacity = capacity;
+}
+
+static void trace_write_name(trace_writer *writer, char *name) {
+	unsigned int len = strlen(name);
+	unsigned int hash = hash_string(name);
+	trace_name *slot = trace_find_name(writer->names, writer->names_capacity,
+									   name, hash);
+
+	if (slot->name) {
+		trace_write_varint(writer, slot->index + 1);
+		return;
+	}
+
+	slot->name = strdup(name);
+	DIE(slot->name == NULL, "strdup failed");
+	slot->hash = hash;
+	slot->index = writer->names_count++;
+
+	trace_write_varint(writer, 0);
+	trace_write_string(writer, name, len);
+
+	// Keep the table at most half full
+	if (2 * writer->names_count > writer->names_capacity) {
+		trace_grow_names(writer);
+	}
+}
+
+void trace_write(trace_writer *writer, trace_record *rec) {
+	char op;
+
+	switch (rec->type) {
+	case ADD_SERVER:
+		op = TRACE_ADD_SERVER;
+		output_write(&writer->out, &op, 1);
+		trace_write_varint(writer, rec->server_id);
+		trace_write_varint(writer, rec->cache_size);
+		trace_write_varint(writer, rec->cache_bytes);
+		trace_write_varint(writer, rec->weight);
+		op = rec->cache_policy;
+		output_write(&writer->out, &op, 1);
+		break;
+	case REMOVE_SERVER:
+		op = TRACE_REMOVE_SERVER;
+		output_write(&writer->out, &op, 1);
+		trace_write_varint(writer, rec->server_id);
+		break;
+	case EDIT_DOCUMENT:
+		op = TRACE_EDIT;
+		output_write(&writer->out, &op, 1);
+		trace_write_name(writer, rec->doc_name);
+		trace_write_string(writer, rec->doc_content, rec->doc_content_len);
+		break;
+	case GET_DOCUMENT:
+		op = TRACE_GET;
+		output_write(&writer->out, &op, 1);
+		trace_write_name(writer, rec->doc_name);
+		break;
+	}
+
+	if (writer->out.len >= OUTPUT_BATCH_BYTES) {
+		output_flush(&writer->out, writer->fd);
+	}
+}
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "input.h"
+#include "cache_policy.h"
+#include "utils.h"
+
+/*
+ * Binary request trace. Numbers are unsigned LEB128 varints and strings
+ * are a varint length, the bytes and a NUL, so a replay hands them out as
+ * views into the mapped file. The file starts with TRACE_MAGIC and the
+ * header options (e.g. "ENABLE_VNODES 64" as a string), followed by the
+ * requests up to its end, each one a TRACE_* byte and:
+ *      TRACE_ADD_SERVER:    server id, entries, bytes, weight, policy byte
+ *      TRACE_REMOVE_SERVER: server id
+ *      TRACE_EDIT:          name, content string
+ *      TRACE_GET:           name
+ * A name is a varint: 0 is followed by the string, a new name which gets
+ * the next index in the dictionary, and k refers to the name with index
+ * k - 1 seen before.
+ */
+#define TRACE_MAGIC             "LBT1"
+#define TRACE_MAGIC_LENGTH      4
+
+#define TRACE_ADD_SERVER        1
+#define TRACE_REMOVE_SERVER     2
+#define TRACE_EDIT              3
+#define TRACE_GET               4
+
+/* A request of any kind, as read from or written to a trace */
+typedef struct trace_record {
+	request_type type;
+	unsigned int server_id;
+	unsigned int cache_size;
+	unsigned long cache_bytes;
+	unsigned int weight;
+	cache_policy_type cache_policy;
+	char *doc_name;
+	char *doc_content;
+	unsigned int doc_content_len;
+} trace_record;
+
+/* Replays a trace mapped by the input module */
+typedef struct trace_reader {
+	input_file *in;
+
+	char **names;           /* Views into the mapping, by index */
+	unsigned int names_count;
+	unsigned int names_capacity;
+} trace_reader;
+
+/* Name already written to the trace, with its dictionary index */
+typedef struct trace_name {
+	char *name;
+	unsigned int hash;
+	unsigned int index;
+} trace_name;
+
+typedef struct trace_writer {
+	int fd;
+	output_buffer out;
+
+	trace_name *names;      /* Open addressing, by hash_string() */
+	unsigned int names_count;
+	unsigned int names_capacity;    /* Power of two */
+} trace_writer;
+
+/**
+ * is_trace_file() - Checks whether the mapped input starts with
+ *      TRACE_MAGIC.
+ */
+bool is_trace_file(input_file *in);
+
+/**
+ * open_trace_reader() - Parses the header of the trace mapped in in and
+ *      copies its options into buffer (truncated to size - 1 bytes).
+ */
+trace_reader *open_trace_reader(input_file *in, char *buffer, size_t size);
+
+/**
+ * close_trace_reader() - Frees the dictionary; the input stays mapped.
+ */
+void close_trace_reader(trace_reader **reader);
+
+/**
+ * trace_next() - Reads the next request. Its name and content are views
+ *      into the mapping, valid as long as the input stays mapped.
+ *
+ * @return - false at the end of the trace.
+ */
+bool trace_next(trace_reader *reader, trace_record *rec);
+
+/**
+ * open_trace_writer() - Creates the trace file and writes its header.
+ */
+trace_writer *open_trace_writer(const char *path, const char *options);
+
+/**
+ * close_trace_writer() - Writes out the buffered requests and closes the
+ *      file.
+ */
+void close_trace_writer(trace_writer **writer);
+
+/**
+ * trace_write() - Appends a request to the trace; only the fields used by
+ *      its type are written.
+ */
+void trace_write(trace_writer *writer, trace_record *rec);
+
+#endif /* TRACE_H */
@@ -2,6 +2,8 @@
  * Copyright (c) 2024, Negru Alexandru
  */
 
+#include <unistd.h>
+
 #include "utils.h"
 
 unsigned int hash_uint(void *key)
@@ -15,6 +17,26 @@ unsigned int hash_uint(void *key)
     return uint_key;
 }
 
+unsigned int hash_vnode(unsigned int server_id, unsigned int replica)
+{
+    unsigned long long label = ((unsigned long long)replica << 32) | server_id;
+
+    label = (label ^ (label >> 33)) * 0xff51afd7ed558ccdULL;
+    label = (label ^ (label >> 33)) * 0xc4ceb9fe1a85ec53ULL;
+    label = label ^ (label >> 33);
+
+    return (unsigned int)label;
+}
+
+unsigned int hash_mix(unsigned int hash, unsigned int seed)
+{
+    hash += seed * 0x9e3779b9u;
+    hash = ((hash >> 16u) ^ hash) * 0x45d9f3b;
+    hash = ((hash >> 16u) ^ hash) * 0x45d9f3b;
+
+    return (hash >> 16u) ^ hash;
+}
+
 unsigned int hash_string(void *key)
 {
     unsigned char *key_string = (unsigned char *) key;
@@ -27,6 +49,64 @@ unsigned int hash_string(void *key)
     return hash;
 }
 
+void output_printf(output_buffer *out, const char *format, ...)
+{
+    va_list args;
+    int len;
+
+    va_start(args, format);
+    len = vsnprintf(out->data ? out->data + out->len : NULL,
+                    out->capacity - out->len, format, args);
+    va_end(args);
+    DIE(len < 0, "vsnprintf failed");
+
+    if (out->len + len < out->capacity) {
+        out->len += len;
+        return;
+    }
+
+    /* Did not fit: grow and format again */
+    while (out->capacity <= out->len + len)
+        out->capacity = out->capacity ? 2 * out->capacity : 4096;
+
+    out->data = realloc(out->data, out->capacity);
+    DIE(out->data == NULL, "realloc failed");
+
+    va_start(args, format);
+    vsnprintf(out->data + out->len, out->capacity - out->len, format, args);
+    va_end(args);
+    out->len += len;
+}
+
+void output_write(output_buffer *out, const char *data, unsigned int len)
+{
+    if (out->len + len > out->capacity) {
+        while (out->capacity < out->len + len)
+            out->capacity = out->capacity ? 2 * out->capacity : 4096;
+
+        out->data = realloc(out->data, out->capacity);
+        DIE(out->data == NULL, "realloc failed");
+    }
+
+    memcpy(out->data + out->len, data, len);
+    out->len += len;
+}
+
+void output_flush(output_buffer *out, int fd)
+{
+    unsigned int written = 0;
+
+    while (written < out->len) {
+        ssize_t ret = write(fd, out->data + written, out->len - written);
+
+        DIE(ret < 0 && errno != EINTR, "write failed");
+        if (ret > 0)
+            written += ret;
+    }
+
+    out->len = 0;
+}
+
 char *get_request_type_str(request_type req_type) {
     switch (req_type) {
     case ADD_SERVER:
@@ -6,6 +6,7 @@
 #define UTILS_H
 
 #include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,16 +22,6 @@
         }                                                                     \
     } while (0)
 
-#define PRINT_RESPONSE(response_ptr) ({                                       \
-    if (response_ptr) {                                                       \
-        printf(GENERIC_MSG, response_ptr->server_id,                          \
-            response_ptr->server_response, response_ptr->server_id,           \
-            response_ptr->server_log);                                        \
-        free(response_ptr->server_response);                                  \
-        free(response_ptr->server_log);                                       \
-        free(response_ptr);}                                                  \
-    })
-
 
 /**
  * @brief Should be used as hash function for server IDs,
@@ -38,12 +29,51 @@
  */
 unsigned int hash_uint(void *key);
 
+/**
+ * @brief Position of the replica-th virtual node of a server on the
+ *      hash ring; distinct (server_id, replica) pairs never share a label
+ */
+unsigned int hash_vnode(unsigned int server_id, unsigned int replica);
+
+/**
+ * @brief Scrambles an already computed hash; distinct seeds give
+ *      independent hashes of the same key (e.g. for sketches and filters)
+ */
+unsigned int hash_mix(unsigned int hash, unsigned int seed);
+
 /**
  * @brief Should be used as hash function for document names,
  *      to find the proper server on the hash ring
 */
 unsigned int hash_string(void *key);
 
+/* Buffered output is written out once it reaches this size */
+#define OUTPUT_BATCH_BYTES      (64 * 1024)
+
+/*
+ * Growable text buffer, for output which has to be printed later
+ */
+typedef struct output_buffer {
+    char *data;
+    unsigned int len;
+    unsigned int capacity;
+} output_buffer;
+
+/**
+ * @brief Appends printf-formatted text to the buffer, growing it as needed
+ */
+void output_printf(output_buffer *out, const char *format, ...);
+
+/**
+ * @brief Appends len bytes to the buffer, growing it as needed
+ */
+void output_write(output_buffer *out, const char *data, unsigned int len);
+
+/**
+ * @brief Writes the whole buffer to the file descriptor and empties it
+ */
+void output_flush(output_buffer *out, int fd);
+
 char *get_request_type_str(request_type req_type);
 request_type get_request_type(char *request_type_str);
 
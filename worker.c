@@ -0,0 +1,231 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#include <sched.h>
+
+#include "worker.h"
+#include "utils.h"
+
+/*
+ * Takes the next task off the ring, spinning for a while before going to
+ * sleep. Returns NULL once the worker is stopped and the ring is empty.
+ */
+static worker_task *worker_pop(server_worker *w) {
+	unsigned int head = atomic_load_explicit(&w->head, memory_order_relaxed);
+	unsigned int spins = 0;
+
+	while (true) {
+		if (head != atomic_load_explicit(&w->tail, memory_order_acquire)) {
+			worker_task *task = w->tasks[head % WORKER_QUEUE_SIZE];
+
+			atomic_store_explicit(&w->head, head + 1, memory_order_release);
+			return task;
+		}
+
+		if (++spins < WORKER_SPINS) {
+			continue;
+		}
+
+		// Announce the nap before checking the ring a last time; the
+		// producer checks the flag after publishing a task, so one of the
+		// two always notices the other
+		pthread_mutex_lock(&w->lock);
+		atomic_store(&w->sleeping, true);
+		while (head == atomic_load(&w->tail) && !w->stop) {
+			pthread_cond_wait(&w->wake, &w->lock);
+		}
+		atomic_store(&w->sleeping, false);
+
+		bool stopped = w->stop && head == atomic_load(&w->tail);
+		pthread_mutex_unlock(&w->lock);
+
+		if (stopped) {
+			return NULL;
+		}
+		spins = 0;
+	}
+}
+
+static void *worker_run(void *arg) {
+	server_worker *w = arg;
+	server *s = w->server;
+	output_buffer *out = s->out;
+	worker_task *task;
+
+	while ((task = worker_pop(w))) {
+		// Everything printed for this request goes to the task
+		s->out = &task->out;
+		server_print_response(s, server_handle_request(s, &task->req));
+		s->out = out;
+
+		atomic_store_explicit(&task->done, true, memory_order_release);
+	}
+
+	return NULL;
+}
+
+void worker_start(server *s) {
+	server_worker *w = calloc(1, sizeof(server_worker));
+	DIE(w == NULL, "calloc failed");
+
+	w->server = s;
+	atomic_init(&w->head, 0);
+	atomic_init(&w->tail, 0);
+	atomic_init(&w->sleeping, false);
+	w->stop = false;
+
+	DIE(pthread_mutex_init(&w->lock, NULL), "pthread_mutex_init failed");
+	DIE(pthread_cond_init(&w->wake, NULL), "pthread_cond_init failed");
+
+	s->worker = w;
+	DIE(pthread_create(&w->thread, NULL, worker_run, w),
+		"pthread_create failed");
+}
+
+void worker_stop(server *s) {
+	server_worker *w = s->worker;
+
+	pthread_mutex_lock(&w->lock);
+	w->stop = true;
+	pthread_cond_signal(&w->wake);
+	pthread_mutex_unlock(&w->lock);
+
+	DIE(pthread_join(w->thread, NULL), "pthread_join failed");
+
+	pthread_mutex_destroy(&w->lock);
+	pthread_cond_destroy(&w->wake);
+	free(w);
+	s->worker = NULL;
+}
+
+worker_pool *init_worker_pool(output_buffer *out) {
+	worker_pool *pool = calloc(1, sizeof(worker_pool));
+	DIE(pool == NULL, "calloc failed");
+
+	pool->out = out;
+
+	return pool;
+}
+
+/* Writes the output of the oldest tasks, as long as they are done */
+static void worker_pool_write_done(worker_pool *pool) {
+	while (pool->count > 0) {
+		worker_task *task = pool->in_flight[pool->first];
+
+		if (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+			return;
+		}
+
+		output_write(pool->out, task->out.data, task->out.len);
+
+		// Keep the task, with its buffers, for a later request
+		task->out.len = 0;
+		atomic_store_explicit(&task->done, false, memory_order_relaxed);
+		task->next_free = pool->free_tasks;
+		pool->free_tasks = task;
+
+		pool->first = (pool->first + 1) % MAX_TASKS_IN_FLIGHT;
+		pool->count--;
+	}
+}
+
+/* Waits for the oldest task and writes the output of the finished ones */
+static void worker_pool_wait_first(worker_pool *pool) {
+	worker_task *task = pool->in_flight[pool->first];
+
+	while (!atomic_load_explicit(&task->done, memory_order_acquire)) {
+		sched_yield();
+	}
+
+	worker_pool_write_done(pool);
+}
+
+static worker_task *worker_task_create(worker_pool *pool, request *req) {
+	worker_task *task = pool->free_tasks;
+
+	if (task) {
+		pool->free_tasks = task->next_free;
+	} else {
+		task = calloc(1, sizeof(worker_task));
+		DIE(task == NULL, "calloc failed");
+		atomic_init(&task->done, false);
+	}
+
+	task->req = *req;
+
+	// The caller frees the request once it is submitted
+	strncpy(task->doc_name, req->doc_name, DOC_NAME_LENGTH);
+	task->req.doc_name = task->doc_name;
+
+	if (req->doc_content) {
+		if (task->content_capacity < req->doc_content_len + 1) {
+			task->content_capacity = req->doc_content_len + 1;
+			task->doc_content = realloc(task->doc_content,
+										task->content_capacity);
+			DIE(task->doc_content == NULL, "realloc failed");
+		}
+
+		memcpy(task->doc_content, req->doc_content, req->doc_content_len + 1);
+		task->req.doc_content = task->doc_content;
+	}
+
+	return task;
+}
+
+static void worker_push(worker_pool *pool, server_worker *w,
+						worker_task *task) {
+	unsigned int tail = atomic_load_explicit(&w->tail, memory_order_relaxed);
+
+	// A full ring empties as the worker runs; keep the output flowing
+	while (tail - atomic_load_explicit(&w->head, memory_order_acquire) ==
+		   WORKER_QUEUE_SIZE) {
+		worker_pool_write_done(pool);
+		sched_yield();
+	}
+
+	w->tasks[tail % WORKER_QUEUE_SIZE] = task;
+	atomic_store(&w->tail, tail + 1);
+
+	if (atomic_load(&w->sleeping)) {
+		pthread_mutex_lock(&w->lock);
+		pthread_cond_signal(&w->wake);
+		pthread_mutex_unlock(&w->lock);
+	}
+}
+
+void worker_pool_submit(worker_pool *pool, server *s, request *req) {
+	if (pool->count == MAX_TASKS_IN_FLIGHT) {
+		worker_pool_wait_first(pool);
+	}
+
+	worker_task *task = worker_task_create(pool, req);
+
+	pool->in_flight[(pool->first + pool->count) % MAX_TASKS_IN_FLIGHT] = task;
+	pool->count++;
+
+	worker_push(pool, s->worker, task);
+	worker_pool_write_done(pool);
+}
+
+void worker_pool_drain(worker_pool *pool) {
+	while (pool->count > 0) {
+		worker_pool_wait_first(pool);
+	}
+}
+
+void free_worker_pool(worker_pool **pool) {
+	worker_pool_drain(*pool);
+
+	while ((*pool)->free_tasks) {
+		worker_task *task = (*pool)->free_tasks;
+
+		(*pool)->free_tasks = task->next_free;
+		free(task->out.data);
+		free(task->doc_content);
+		free(task);
+	}
+
+	free(*pool);
+	*pool = NULL;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2024, Negru Alexandru
+ */
+
+#ifndef WORKER_H
+#define WORKER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "server.h"
+
+#define WORKER_QUEUE_SIZE       1024    /* Power of two */
+#define MAX_TASKS_IN_FLIGHT     4096
+#define WORKER_SPINS            4096
+
+/*
+ * A request handed to a server's worker, with its own copy of the name and
+ * content, and the text the server printed while handling it.
+ */
+typedef struct worker_task {
+	request req;
+	char doc_name[DOC_NAME_LENGTH + 1];
+	char *doc_content;
+	unsigned int content_capacity;
+
+	output_buffer out;
+	atomic_bool done;
+
+	struct worker_task *next_free;
+} worker_task;
+
+/*
+ * Thread owning a server. The load balancer thread is the only producer of
+ * its task ring and the worker the only consumer, so head and tail need no
+ * lock; the mutex only guards going to sleep on an empty ring.
+ */
+struct server_worker {
+	server *server;
+	pthread_t thread;
+
+	worker_task *tasks[WORKER_QUEUE_SIZE];
+	atomic_uint head;       /* Next task to run, advanced by the worker */
+	atomic_uint tail;       /* Next free slot, advanced by the producer */
+
+	atomic_bool sleeping;
+	bool stop;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+};
+
+/*
+ * Sequencer: the tasks dispatched to any worker, in dispatch order. Their
+ * output is written in that order once they are done, so it matches a run
+ * on a single thread.
+ */
+typedef struct worker_pool {
+	worker_task *in_flight[MAX_TASKS_IN_FLIGHT];
+	unsigned int first;
+	unsigned int count;
+
+	worker_task *free_tasks;
+	output_buffer *out;
+} worker_pool;
+
+/**
+ * init_worker_pool() - Creates an empty sequencer appending to out.
+ */
+worker_pool *init_worker_pool(output_buffer *out);
+
+/**
+ * free_worker_pool() - Writes the output of the remaining tasks and frees
+ *      the pool. The workers must be stopped separately.
+ */
+void free_worker_pool(worker_pool **pool);
+
+/**
+ * worker_start() - Starts a thread which handles the server's requests
+ *      from now on. Only that thread may touch the server until
+ *      worker_pool_drain() returns.
+ */
+void worker_start(server *s);
+
+/**
+ * worker_stop() - Lets the server's worker finish its tasks and joins it.
+ */
+void worker_stop(server *s);
+
+/**
+ * worker_pool_submit() - Queues a copy of the request on the server's
+ *      worker and writes the output of the tasks completed so far.
+ */
+void worker_pool_submit(worker_pool *pool, server *s, request *req);
+
+/**
+ * worker_pool_drain() - Waits for every dispatched task and appends its
+ *      output. Afterwards the servers may be used from the caller's thread
+ *      until the next submit.
+ */
+void worker_pool_drain(worker_pool *pool);
+
+#endif /* WORKER_H */